@@ -19,22 +19,33 @@
  * engine in C. It was written as part of a Nintendo *
  * Entertainment System emulator I've been writing.  *
  *                                                   *
- * A couple important things to know about are two   *
- * defines in the code. One is "UNDOCUMENTED" which, *
- * when defined, allows Fake6502 to compile with     *
- * full support for the more predictable             *
- * undocumented instructions of the 6502. If it is   *
- * undefined, undocumented opcodes just act as NOPs. *
+ * This file is built once per core variant: each   *
+ * core_*.c file sets CORE (the suffix given to the  *
+ * public functions) and the feature defines, then   *
+ * includes this file. core.c picks the variant for  *
+ * each CPU from cpu.core at run time.               *
+ *                                                   *
+ * One define is "UNDOCUMENTED" which, when          *
+ * defined, allows Fake6502 to compile with full     *
+ * support for the more predictable undocumented     *
+ * instructions of the 6502. If it is undefined,     *
+ * undocumented opcodes just act as NOPs.            *
  *                                                   *
  * The other define is "NES_CPU", which causes the   *
  * code to compile without support for binary-coded  *
  * decimal (BCD) support for the ADC and SBC         *
  * opcodes. The Ricoh 2A03 CPU in the NES does not   *
  * support BCD, but is otherwise identical to the    *
- * standard MOS 6502. (Note that this define is      *
- * enabled in this file if you haven't changed it    *
- * yourself. If you're not emulating a NES, you      *
- * should comment it out.)                           *
+ * standard MOS 6502.                                *
+ *                                                   *
+ * "CMOS" selects the WDC 65C02 tables instead: the  *
+ * new opcodes and (zp) addressing, the indirect JMP *
+ * page bug fixed, and WAI and STP, which park the   *
+ * CPU in cpu.halt. A parked CPU skips straight to   *
+ * the next deadline without running anything until  *
+ * irq6502() or nmi6502() (WAI) or reset6502() (STP) *
+ * releases it. "CMOS_TABLES" only compiles those    *
+ * tables alongside the NMOS ones, for disasm.c.     *
  *                                                   *
  * If you do discover an error in timing accuracy,   *
  * or operation in general please e-mail me at the   *
@@ -43,27 +54,26 @@
  *****************************************************
  * Usage:                                            *
  *                                                   *
- * Fake6502 requires you to provide two external     *
+ * Fake6502 requires you to provide three external   *
  * functions:                                        *
  *                                                   *
  * uint8_t read6502(uint16_t address)                *
+ * uint8_t fetch6502(uint16_t address)               *
  * void write6502(uint16_t address, uint8_t value)   *
  *                                                   *
- * You may optionally pass Fake6502 the pointer to a *
- * function which you want to be called after every  *
- * emulated instruction. This function should be a   *
- * void with no parameters expected to be passed to  *
- * it.                                               *
+ * fetch6502() is only used for opcode fetches, so a *
+ * board can trap execution separately from reads.   *
  *                                                   *
- * This can be very useful. For example, in a NES    *
- * emulator, you check the number of clock ticks     *
- * that have passed so you can know when to handle   *
- * APU events.                                       *
+ * Devices that run alongside the CPU register       *
+ * callbacks at absolute cycle times with schedule() *
+ * (see scheduler.c). exec6502() runs straight to    *
+ * the next event deadline, fires whatever is due    *
+ * and carries on, so there is no per-instruction    *
+ * check.                                            *
  *                                                   *
- * To pass Fake6502 this pointer, use the            *
- * hookexternal(void *funcptr) function provided.    *
- *                                                   *
- * To disable the hook later, pass NULL to it.       *
+ * This can be very useful. For example, in a NES    *
+ * emulator, you schedule the APU's next event and   *
+ * it fires exactly at the cycle it is due.          *
  *****************************************************
  * Useful functions in this emulator:                *
  *                                                   *
@@ -72,7 +82,13 @@
 *                                                   *
 * void exec6502(uint32_t tickcount)                 *
 *   - Execute 6502 code up to the next specified    *
-*     count of clock ticks.                         *
+*     count of clock ticks, firing scheduled        *
+*     events as their deadlines are reached.        *
+*                                                   *
+* void run6502(uint64_t deadline)                   *
+*   - Execute 6502 code until the cycle count       *
+*     reaches deadline without firing events, for   *
+*     boards that drive the scheduler themselves.   *
 *                                                   *
 * void step6502()                                   *
 *   - Execute a single instrution.                  *
@@ -83,16 +99,10 @@
 * void nmi6502()                                    *
 *   - Trigger an NMI in the 6502 core.              *
 *                                                   *
-* void hookexternal(void *funcptr)                  *
-*   - Pass a pointer to a void function taking no   *
-*     parameters. This will cause Fake6502 to call  *
-*     that function once after each emulated        *
-*     instruction.                                  *
-*                                                   *
 *****************************************************
 * Useful variables in this emulator:                *
 *                                                   *
-* uint32_t clockticks6502                           *
+* uint64_t clockticks6502                           *
 *   - A running total of the emulated cycle count.  *
 *                                                   *
 * uint32_t instructions                             *
@@ -105,26 +115,34 @@
 #include <stdio.h>
 #include <stdint.h>
 
-//6502 defines
-#define UNDOCUMENTED //when this is defined, undocumented opcodes are handled.
+//6502 defines, set by the core_*.c variant that includes this file
+//UNDOCUMENTED: when this is defined, undocumented opcodes are handled.
 //otherwise, they're simply treated as NOPs.
 
-//#define NES_CPU      //when this is defined, the binary-coded decimal (BCD)
+//NES_CPU: when this is defined, the binary-coded decimal (BCD)
 //status flag is not honored by ADC and SBC. the 2A03
 //CPU in the Nintendo Entertainment System does not
 //support BCD operation.
 
-#define FLAG_CARRY     0x01
-#define FLAG_ZERO      0x02
-#define FLAG_INTERRUPT 0x04
-#define FLAG_DECIMAL   0x08
-#define FLAG_BREAK     0x10
-#define FLAG_CONSTANT  0x20
-#define FLAG_OVERFLOW  0x40
-#define FLAG_SIGN      0x80
+//CMOS: the WDC 65C02 instruction set, see the notes above.
+#ifndef CORE
+#error "build 6502.c through one of the core_*.c variants"
+#endif
+
+//public entry points get the variant suffix, e.g. step6502_nmos
+#define COREPASTE(name, core) name##_##core
+#define COREJOIN(name, core) COREPASTE(name, core)
+#define COREFN(name) COREJOIN(name, CORE)
 
 #define BASE_STACK     0x100
 
+#ifdef CMOS
+#define CMOS_TABLES
+#define addrtable addrtable65c02
+#define optable optable65c02
+#define ticktable ticktable65c02
+#endif
+
 #define saveaccum(n) cpu.a = (uint8_t)((n) & 0x00FF)
 
 
@@ -165,48 +183,64 @@
 }
 
 #include "cpu.h"
+#include "scheduler.h"
 
-CPU_State cpu = {0};
+extern CPU_State cpu;
 
-//externally supplied functions
+//externally supplied functions, fetch6502() reads opcodes
 extern uint8_t read6502(uint16_t address);
+extern uint8_t fetch6502(uint16_t address);
 extern void write6502(uint16_t address, uint8_t value);
 
+//execution tracing, see trace.c
+extern uint8_t tracing;
+extern void tracerecord(CPU_State *c, uint16_t pc);
+extern void tracewrite(uint16_t address, uint8_t value);
+
+static void putbus(uint16_t address, uint8_t value) {
+  if (tracing) tracewrite(address, value);
+  write6502(address, value);
+}
+
 //a few general functions used by various other functions
-void push16(uint16_t pushval) {
-  write6502(BASE_STACK + cpu.sp, (pushval >> 8) & 0xFF);
-  write6502(BASE_STACK + ((cpu.sp - 1) & 0xFF), pushval & 0xFF);
+static void push16(uint16_t pushval) {
+  putbus(BASE_STACK + cpu.sp, (pushval >> 8) & 0xFF);
+  putbus(BASE_STACK + ((cpu.sp - 1) & 0xFF), pushval & 0xFF);
   cpu.sp -= 2;
 }
 
-void push8(uint8_t pushval) {
-  write6502(BASE_STACK + cpu.sp--, pushval);
+static void push8(uint8_t pushval) {
+  putbus(BASE_STACK + cpu.sp--, pushval);
 }
 
-uint16_t pull16() {
+static uint16_t pull16() {
   uint16_t temp16;
   temp16 = read6502(BASE_STACK + ((cpu.sp + 1) & 0xFF)) | ((uint16_t)read6502(BASE_STACK + ((cpu.sp + 2) & 0xFF)) << 8);
   cpu.sp += 2;
   return(temp16);
 }
 
-uint8_t pull8() {
+static uint8_t pull8() {
   return (read6502(BASE_STACK + ++cpu.sp));
 }
 
-void reset6502() {
+void COREFN(reset6502)() {
   cpu.pc = (uint16_t)read6502(0xFFFC) | ((uint16_t)read6502(0xFFFD) << 8);
   cpu.a = 0;
   cpu.x = 0;
   cpu.y = 0;
   cpu.sp = 0xFD;
   cpu.status |= FLAG_CONSTANT;
+  cpu.halt = 0;
+#ifdef CMOS
+  cleardecimal();
+#endif
 }
 
 
 static void (*addrtable[256])();
 static void (*optable[256])();
-uint8_t penaltyop, penaltyaddr;
+static uint8_t penaltyop, penaltyaddr;
 
 //addressing mode functions, calculates effective addresses
 static void imp() { //implied
@@ -270,7 +304,11 @@ static void absy() { //absolute,Y
 static void ind() { //indirect
   uint16_t eahelp, eahelp2;
   eahelp = (uint16_t)read6502(cpu.pc) | (uint16_t)((uint16_t)read6502(cpu.pc+1) << 8);
+#ifdef CMOS
+  eahelp2 = eahelp + 1; //fixed on the 65C02
+#else
   eahelp2 = (eahelp & 0xFF00) | ((eahelp + 1) & 0x00FF); //replicate 6502 page-boundary wraparound bug
+#endif
   cpu.ea = (uint16_t)read6502(eahelp) | ((uint16_t)read6502(eahelp2) << 8);
   cpu.pc += 2;
 }
@@ -305,7 +343,7 @@ static uint16_t getvalue16() {
 
 static void putvalue(uint16_t saveval) {
   if (addrtable[cpu.opcode] == acc) cpu.a = (uint8_t)(saveval & 0x00FF);
-  else write6502(cpu.ea, (saveval & 0x00FF));
+  else putbus(cpu.ea, (saveval & 0x00FF));
 }
 
 
@@ -351,6 +389,9 @@ static void and() {
 }
 
 static void asl() {
+#ifdef CMOS
+  penaltyop = 1; //abs,X only takes the extra cycle on a page crossing
+#endif
   cpu.value = getvalue();
   cpu.result = cpu.value << 1;
 
@@ -393,6 +434,10 @@ static void bit() {
   cpu.result = (uint16_t)cpu.a & cpu.value;
 
   zerocalc(cpu.result);
+#ifdef CMOS
+  penaltyop = 1;
+  if (addrtable[cpu.opcode] == imm) return; //bit # only sets the zero flag
+#endif
   cpu.status = (cpu.status & 0x3F) | (uint8_t)(cpu.value & 0xC0);
 }
 
@@ -428,6 +473,9 @@ static void brk() {
   push16(cpu.pc); //push next instruction address onto stack
   push8(cpu.status | FLAG_BREAK); //push CPU cpu.status to stack
   setinterrupt(); //set interrupt flag
+#ifdef CMOS
+  cleardecimal();
+#endif
   cpu.pc = (uint16_t)read6502(0xFFFE) | ((uint16_t)read6502(0xFFFF) << 8);
 }
 
@@ -595,6 +643,9 @@ static void ldy() {
 }
 
 static void lsr() {
+#ifdef CMOS
+  penaltyop = 1;
+#endif
   cpu.value = getvalue();
   cpu.result = cpu.value >> 1;
 
@@ -650,6 +701,9 @@ static void plp() {
 }
 
 static void rol() {
+#ifdef CMOS
+  penaltyop = 1;
+#endif
   cpu.value = getvalue();
   cpu.result = (cpu.value << 1) | (cpu.status & FLAG_CARRY);
 
@@ -661,6 +715,9 @@ static void rol() {
 }
 
 static void ror() {
+#ifdef CMOS
+  penaltyop = 1;
+#endif
   cpu.value = getvalue();
   cpu.result = (cpu.value >> 1) | ((cpu.status & FLAG_CARRY) << 7);
 
@@ -836,6 +893,173 @@ static void rra() {
 #define rra nop
 #endif
 
+//65C02 addressing modes and instructions
+#ifdef CMOS_TABLES
+static void zpi() { // (zero-page indirect)
+  uint16_t eahelp;
+  eahelp = (uint16_t)read6502(cpu.pc++);
+  cpu.ea = (uint16_t)read6502(eahelp) | ((uint16_t)read6502((eahelp + 1) & 0x00FF) << 8); //zero-page wraparound
+}
+
+static void ainx() { // (absolute,X), jmp only
+  uint16_t eahelp;
+  eahelp = ((uint16_t)read6502(cpu.pc) | ((uint16_t)read6502(cpu.pc+1) << 8)) + (uint16_t)cpu.x;
+  cpu.ea = (uint16_t)read6502(eahelp) | ((uint16_t)read6502(eahelp+1) << 8);
+  cpu.pc += 2;
+}
+
+static void zprel() { //zero-page then relative, for bbr and bbs
+  cpu.ea = (uint16_t)read6502(cpu.pc++);
+  cpu.reladdr = (uint16_t)read6502(cpu.pc++);
+  if (cpu.reladdr & 0x80) cpu.reladdr |= 0xFF00;
+}
+
+static void bra() {
+  cpu.oldpc = cpu.pc;
+  cpu.pc += cpu.reladdr;
+  if ((cpu.oldpc & 0xFF00) != (cpu.pc & 0xFF00)) cpu.clockticks6502 += 2; //check if jump crossed a page boundary
+  else cpu.clockticks6502++;
+}
+
+//bbr0-7 and bbs0-7 test, rmb0-7 and smb0-7 change, bit (opcode >> 4) & 7
+static void bbr() {
+  if ((read6502(cpu.ea) & (1 << ((cpu.opcode >> 4) & 7))) == 0) {
+    cpu.oldpc = cpu.pc;
+    cpu.pc += cpu.reladdr;
+    if ((cpu.oldpc & 0xFF00) != (cpu.pc & 0xFF00)) cpu.clockticks6502 += 2; //check if jump crossed a page boundary
+    else cpu.clockticks6502++;
+  }
+}
+
+static void bbs() {
+  if (read6502(cpu.ea) & (1 << ((cpu.opcode >> 4) & 7))) {
+    cpu.oldpc = cpu.pc;
+    cpu.pc += cpu.reladdr;
+    if ((cpu.oldpc & 0xFF00) != (cpu.pc & 0xFF00)) cpu.clockticks6502 += 2; //check if jump crossed a page boundary
+    else cpu.clockticks6502++;
+  }
+}
+
+static void rmb() {
+  putvalue(getvalue() & ~(1 << ((cpu.opcode >> 4) & 7)));
+}
+
+static void smb() {
+  putvalue(getvalue() | (1 << ((cpu.opcode >> 4) & 7)));
+}
+
+static void phx() {
+  push8(cpu.x);
+}
+
+static void phy() {
+  push8(cpu.y);
+}
+
+static void plx() {
+  cpu.x = pull8();
+
+  zerocalc(cpu.x);
+  signcalc(cpu.x);
+}
+
+static void ply() {
+  cpu.y = pull8();
+
+  zerocalc(cpu.y);
+  signcalc(cpu.y);
+}
+
+static void stz() {
+  putvalue(0);
+}
+
+static void trb() {
+  cpu.value = getvalue();
+
+  zerocalc(cpu.value & cpu.a);
+
+  putvalue(cpu.value & ~cpu.a);
+}
+
+static void tsb() {
+  cpu.value = getvalue();
+
+  zerocalc(cpu.value & cpu.a);
+
+  putvalue(cpu.value | cpu.a);
+}
+
+static void wai() {
+  cpu.halt = HALT_WAI;
+}
+
+static void stp() {
+  cpu.halt = HALT_STP;
+}
+
+static void (*addrtable65c02[256])() = {
+  /*        |  0  |  1  |  2  |  3  |  4  |  5  |  6  |  7  |  8  |  9  |  A  |  B  |  C  |  D  |  E  |  F  |     */
+  /* 0 */     imp, indx,  imm,  imp,   zp,   zp,   zp,   zp,  imp,  imm,  acc,  imp, abso, abso, abso,zprel, /* 0 */
+  /* 1 */     rel, indy,  zpi,  imp,   zp,  zpx,  zpx,   zp,  imp, absy,  acc,  imp, abso, absx, absx,zprel, /* 1 */
+  /* 2 */    abso, indx,  imm,  imp,   zp,   zp,   zp,   zp,  imp,  imm,  acc,  imp, abso, abso, abso,zprel, /* 2 */
+  /* 3 */     rel, indy,  zpi,  imp,  zpx,  zpx,  zpx,   zp,  imp, absy,  acc,  imp, absx, absx, absx,zprel, /* 3 */
+  /* 4 */     imp, indx,  imm,  imp,   zp,   zp,   zp,   zp,  imp,  imm,  acc,  imp, abso, abso, abso,zprel, /* 4 */
+  /* 5 */     rel, indy,  zpi,  imp,  zpx,  zpx,  zpx,   zp,  imp, absy,  imp,  imp, abso, absx, absx,zprel, /* 5 */
+  /* 6 */     imp, indx,  imm,  imp,   zp,   zp,   zp,   zp,  imp,  imm,  acc,  imp,  ind, abso, abso,zprel, /* 6 */
+  /* 7 */     rel, indy,  zpi,  imp,  zpx,  zpx,  zpx,   zp,  imp, absy,  imp,  imp, ainx, absx, absx,zprel, /* 7 */
+  /* 8 */     rel, indx,  imm,  imp,   zp,   zp,   zp,   zp,  imp,  imm,  imp,  imp, abso, abso, abso,zprel, /* 8 */
+  /* 9 */     rel, indy,  zpi,  imp,  zpx,  zpx,  zpy,   zp,  imp, absy,  imp,  imp, abso, absx, absx,zprel, /* 9 */
+  /* A */     imm, indx,  imm,  imp,   zp,   zp,   zp,   zp,  imp,  imm,  imp,  imp, abso, abso, abso,zprel, /* A */
+  /* B */     rel, indy,  zpi,  imp,  zpx,  zpx,  zpy,   zp,  imp, absy,  imp,  imp, absx, absx, absy,zprel, /* B */
+  /* C */     imm, indx,  imm,  imp,   zp,   zp,   zp,   zp,  imp,  imm,  imp,  imp, abso, abso, abso,zprel, /* C */
+  /* D */     rel, indy,  zpi,  imp,  zpx,  zpx,  zpx,   zp,  imp, absy,  imp,  imp, abso, absx, absx,zprel, /* D */
+  /* E */     imm, indx,  imm,  imp,   zp,   zp,   zp,   zp,  imp,  imm,  imp,  imp, abso, abso, abso,zprel, /* E */
+  /* F */     rel, indy,  zpi,  imp,  zpx,  zpx,  zpx,   zp,  imp, absy,  imp,  imp, abso, absx, absx,zprel  /* F */
+};
+
+static void (*optable65c02[256])() = {
+  /*        |  0  |  1  |  2  |  3  |  4  |  5  |  6  |  7  |  8  |  9  |  A  |  B  |  C  |  D  |  E  |  F  |      */
+  /* 0 */      brk,  ora,  nop,  nop,  tsb,  ora,  asl,  rmb,  php,  ora,  asl,  nop,  tsb,  ora,  asl,  bbr, /* 0 */
+  /* 1 */      bpl,  ora,  ora,  nop,  trb,  ora,  asl,  rmb,  clc,  ora,  inc,  nop,  trb,  ora,  asl,  bbr, /* 1 */
+  /* 2 */      jsr,  and,  nop,  nop,  bit,  and,  rol,  rmb,  plp,  and,  rol,  nop,  bit,  and,  rol,  bbr, /* 2 */
+  /* 3 */      bmi,  and,  and,  nop,  bit,  and,  rol,  rmb,  sec,  and,  dec,  nop,  bit,  and,  rol,  bbr, /* 3 */
+  /* 4 */      rti,  eor,  nop,  nop,  nop,  eor,  lsr,  rmb,  pha,  eor,  lsr,  nop,  jmp,  eor,  lsr,  bbr, /* 4 */
+  /* 5 */      bvc,  eor,  eor,  nop,  nop,  eor,  lsr,  rmb,  cli,  eor,  phy,  nop,  nop,  eor,  lsr,  bbr, /* 5 */
+  /* 6 */      rts,  adc,  nop,  nop,  stz,  adc,  ror,  rmb,  pla,  adc,  ror,  nop,  jmp,  adc,  ror,  bbr, /* 6 */
+  /* 7 */      bvs,  adc,  adc,  nop,  stz,  adc,  ror,  rmb,  sei,  adc,  ply,  nop,  jmp,  adc,  ror,  bbr, /* 7 */
+  /* 8 */      bra,  sta,  nop,  nop,  sty,  sta,  stx,  smb,  dey,  bit,  txa,  nop,  sty,  sta,  stx,  bbs, /* 8 */
+  /* 9 */      bcc,  sta,  sta,  nop,  sty,  sta,  stx,  smb,  tya,  sta,  txs,  nop,  stz,  sta,  stz,  bbs, /* 9 */
+  /* A */      ldy,  lda,  ldx,  nop,  ldy,  lda,  ldx,  smb,  tay,  lda,  tax,  nop,  ldy,  lda,  ldx,  bbs, /* A */
+  /* B */      bcs,  lda,  lda,  nop,  ldy,  lda,  ldx,  smb,  clv,  lda,  tsx,  nop,  ldy,  lda,  ldx,  bbs, /* B */
+  /* C */      cpy,  cmp,  nop,  nop,  cpy,  cmp,  dec,  smb,  iny,  cmp,  dex,  wai,  cpy,  cmp,  dec,  bbs, /* C */
+  /* D */      bne,  cmp,  cmp,  nop,  nop,  cmp,  dec,  smb,  cld,  cmp,  phx,  stp,  nop,  cmp,  dec,  bbs, /* D */
+  /* E */      cpx,  sbc,  nop,  nop,  cpx,  sbc,  inc,  smb,  inx,  sbc,  nop,  nop,  cpx,  sbc,  inc,  bbs, /* E */
+  /* F */      beq,  sbc,  sbc,  nop,  nop,  sbc,  inc,  smb,  sed,  sbc,  plx,  nop,  nop,  sbc,  inc,  bbs  /* F */
+};
+
+static const uint32_t ticktable65c02[256] = {
+  /*        |  0  |  1  |  2  |  3  |  4  |  5  |  6  |  7  |  8  |  9  |  A  |  B  |  C  |  D  |  E  |  F  |     */
+  /* 0 */      7,    6,    2,    1,    5,    3,    5,    5,    3,    2,    2,    1,    6,    4,    6,    5,  /* 0 */
+  /* 1 */      2,    5,    5,    1,    5,    4,    6,    5,    2,    4,    2,    1,    6,    4,    6,    5,  /* 1 */
+  /* 2 */      6,    6,    2,    1,    3,    3,    5,    5,    4,    2,    2,    1,    4,    4,    6,    5,  /* 2 */
+  /* 3 */      2,    5,    5,    1,    4,    4,    6,    5,    2,    4,    2,    1,    4,    4,    6,    5,  /* 3 */
+  /* 4 */      6,    6,    2,    1,    3,    3,    5,    5,    3,    2,    2,    1,    3,    4,    6,    5,  /* 4 */
+  /* 5 */      2,    5,    5,    1,    4,    4,    6,    5,    2,    4,    3,    1,    8,    4,    6,    5,  /* 5 */
+  /* 6 */      6,    6,    2,    1,    3,    3,    5,    5,    4,    2,    2,    1,    6,    4,    6,    5,  /* 6 */
+  /* 7 */      2,    5,    5,    1,    4,    4,    6,    5,    2,    4,    4,    1,    6,    4,    6,    5,  /* 7 */
+  /* 8 */      2,    6,    2,    1,    3,    3,    3,    5,    2,    2,    2,    1,    4,    4,    4,    5,  /* 8 */
+  /* 9 */      2,    6,    5,    1,    4,    4,    4,    5,    2,    5,    2,    1,    4,    5,    5,    5,  /* 9 */
+  /* A */      2,    6,    2,    1,    3,    3,    3,    5,    2,    2,    2,    1,    4,    4,    4,    5,  /* A */
+  /* B */      2,    5,    5,    1,    4,    4,    4,    5,    2,    4,    2,    1,    4,    4,    4,    5,  /* B */
+  /* C */      2,    6,    2,    1,    3,    3,    5,    5,    2,    2,    2,    3,    4,    4,    6,    5,  /* C */
+  /* D */      2,    5,    5,    1,    4,    4,    6,    5,    2,    4,    3,    3,    4,    4,    7,    5,  /* D */
+  /* E */      2,    6,    2,    1,    3,    3,    5,    5,    2,    2,    2,    1,    4,    4,    6,    5,  /* E */
+  /* F */      2,    5,    5,    1,    4,    4,    6,    5,    2,    4,    4,    1,    4,    4,    7,    5   /* F */
+};
+#endif
+
+#ifndef CMOS
 
 static void (*addrtable[256])() = {
   /*        |  0  |  1  |  2  |  3  |  4  |  5  |  6  |  7  |  8  |  9  |  A  |  B  |  C  |  D  |  E  |  F  |     */
@@ -896,49 +1120,43 @@ static const uint32_t ticktable[256] = {
   /* E */      2,    6,    2,    8,    3,    3,    5,    5,    2,    2,    2,    2,    4,    4,    6,    6,  /* E */
   /* F */      2,    5,    2,    8,    4,    4,    6,    6,    2,    4,    2,    7,    4,    4,    7,    7   /* F */
 };
+#endif
 
 
-void nmi6502() {
+void COREFN(nmi6502)() {
+#ifdef CMOS
+  if (cpu.halt == HALT_STP) return;
+  cpu.halt = 0;
+#endif
   push16(cpu.pc);
   push8(cpu.status);
   cpu.status |= FLAG_INTERRUPT;
+#ifdef CMOS
+  cleardecimal();
+#endif
   cpu.pc = (uint16_t)read6502(0xFFFA) | ((uint16_t)read6502(0xFFFB) << 8);
 }
 
-void irq6502() {
+void COREFN(irq6502)() {
+#ifdef CMOS
+  if (cpu.halt == HALT_STP) return;
+  if (cpu.halt == HALT_WAI) {
+    cpu.halt = 0;
+    if (cpu.status & FLAG_INTERRUPT) return; //wai with irqs masked just resumes
+  }
+#endif
   push16(cpu.pc);
   push8(cpu.status);
   cpu.status |= FLAG_INTERRUPT;
+#ifdef CMOS
+  cleardecimal();
+#endif
   cpu.pc = (uint16_t)read6502(0xFFFE) | ((uint16_t)read6502(0xFFFF) << 8);
 }
 
-uint8_t callexternal = 0;
-void (*loopexternal)();
-
-void exec6502(uint32_t tickcount) {
-  cpu.clockgoal6502 += tickcount;
-
-  while (cpu.clockticks6502 < cpu.clockgoal6502) {
-    cpu.opcode = read6502(cpu.pc++);
-    cpu.status |= FLAG_CONSTANT;
-
-    penaltyop = 0;
-    penaltyaddr = 0;
-
-    (*addrtable[cpu.opcode])();
-    (*optable[cpu.opcode])();
-    cpu.clockticks6502 += ticktable[cpu.opcode];
-    if (penaltyop && penaltyaddr) cpu.clockticks6502++;
-
-    cpu.instructions++;
-
-    if (callexternal) (*loopexternal)();
-  }
-
-}
-
-void step6502() {
-  cpu.opcode = read6502(cpu.pc++);
+static inline void instruction6502() {
+  uint16_t pc = cpu.pc;
+  cpu.opcode = fetch6502(cpu.pc++);
   cpu.status |= FLAG_CONSTANT;
 
   penaltyop = 0;
@@ -948,16 +1166,58 @@ void step6502() {
   (*optable[cpu.opcode])();
   cpu.clockticks6502 += ticktable[cpu.opcode];
   if (penaltyop && penaltyaddr) cpu.clockticks6502++;
-  cpu.clockgoal6502 = cpu.clockticks6502;
 
   cpu.instructions++;
 
-  if (callexternal) (*loopexternal)();
+  if (tracing) tracerecord(&cpu, pc);
+}
+
+//BLOCKS: defined by ROMs recompiled with recomp.c, which include this file
+//and supply their own runto() that runs native blocks where they can
+#ifdef BLOCKS
+static void runto(uint64_t deadline);
+#elif defined(CMOS)
+//only events at a deadline can release a cpu parked by wai or stp, so it
+//skips straight there
+static inline void runto(uint64_t deadline) {
+  while (cpu.clockticks6502 < deadline) {
+    if (cpu.halt) {
+      cpu.clockticks6502 = deadline;
+      break;
+    }
+    instruction6502();
+  }
+}
+#else
+static inline void runto(uint64_t deadline) {
+  while (cpu.clockticks6502 < deadline) instruction6502();
+}
+#endif
+
+void COREFN(exec6502)(uint32_t tickcount) {
+  cpu.clockgoal6502 += tickcount;
+
+  while (cpu.clockticks6502 < cpu.clockgoal6502) {
+    uint64_t deadline = schednext();
+    if (deadline > cpu.clockgoal6502) deadline = cpu.clockgoal6502;
+
+    runto(deadline);
+
+    schedrun(cpu.clockticks6502);
+  }
 }
 
-void hookexternal(void *funcptr) {
-  if (funcptr != (void *)NULL) {
-    loopexternal = funcptr;
-    callexternal = 1;
-  } else callexternal = 0;
+void COREFN(run6502)(uint64_t deadline) {
+  runto(deadline);
+  cpu.clockgoal6502 = cpu.clockticks6502;
+}
+
+void COREFN(step6502)() {
+#ifdef CMOS
+  if (cpu.halt) cpu.clockticks6502++; //parked, idle for a cycle
+  else instruction6502();
+#else
+  instruction6502();
+#endif
+  cpu.clockgoal6502 = cpu.clockticks6502;
 }
@@ -0,0 +1,225 @@
+/* Tone and noise generator.
+ *
+ * Two square wave channels and one noise channel (a 15-bit lfsr), mixed
+ * into mono 16-bit samples. The device is not stepped with the cpu: it
+ * remembers the cycle it last generated up to, and audiosync() renders
+ * the samples between then and now in one batch. That happens before
+ * every register write, so a change takes effect at the exact cycle it
+ * was made, and at every frame boundary.
+ *
+ * Samples go to a lock-free ring drained by the SDL audio callback, or
+ * to a wav file when started with a path. The emulator never waits for
+ * audio. Instead, at every frame the cycles per sample are nudged by up
+ * to AUDIO_SLEW so the ring stays around AUDIO_TARGET samples: a host
+ * clock that runs a little fast or slow changes the pitch by a fraction
+ * of a percent rather than underrunning or stalling the emulation.
+ * Underruns play the last sample again and are counted in telemetry.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <SDL2/SDL.h>
+#include "audio.h"
+#include "telemetry.h"
+
+#define AUDIO_RING 8192 //samples, power of two
+#define AUDIO_DEVICE 1024 //samples per SDL callback
+#define AUDIO_TARGET 2048 //ring fill the rate control aims for
+#define AUDIO_SLEW 0.005 //largest rate correction
+#define AUDIO_BATCH 512
+
+static struct {
+  _Alignas(64) atomic_uint head;
+  _Alignas(64) atomic_uint tail;
+  int16_t samples[AUDIO_RING];
+} ring;
+
+typedef struct {
+  uint16_t period;
+  uint8_t volume, out;
+  int64_t count; //16.16 cycles until the next edge
+} Audio_Channel;
+
+static uint8_t regs[8];
+static Audio_Channel channel[3];
+static uint16_t lfsr = 1;
+
+static uint8_t running;
+static FILE *wav;
+static uint32_t wavrate, wavbytes;
+static SDL_AudioDeviceID device;
+static int16_t last;
+
+static uint64_t synced; //cycle everything before has been rendered
+static int64_t phase; //16.16 cycles since the last sample
+static int64_t nominal, step; //16.16 cycles per sample
+
+static int16_t batch[AUDIO_BATCH];
+static uint32_t batched;
+
+static void callback(void *userdata, uint8_t *stream, int len) {
+  int16_t *out = (int16_t *)stream;
+  int n = len / 2;
+  unsigned head = atomic_load_explicit(&ring.head, memory_order_relaxed);
+  unsigned tail = atomic_load_explicit(&ring.tail, memory_order_acquire);
+
+  for (int i = 0; i < n; i++) {
+    if (head == tail) {
+      telemetryunderrun(n - i);
+      for (; i < n; i++) out[i] = last;
+      break;
+    }
+    out[i] = last = ring.samples[head++ & (AUDIO_RING - 1)];
+  }
+  atomic_store_explicit(&ring.head, head, memory_order_release);
+}
+
+static void wavheader(FILE *f, uint32_t rate, uint32_t bytes) {
+  uint8_t h[44];
+  uint32_t v[] = { 36 + bytes, 16, 1 | (1 << 16), rate, rate * 2, 2 | (16 << 16), bytes };
+
+  memcpy(h, "RIFF", 4);
+  memcpy(h + 8, "WAVEfmt ", 8);
+  memcpy(h + 36, "data", 4);
+  memcpy(h + 4, &v[0], 4);
+  memcpy(h + 16, &v[1], 20);
+  memcpy(h + 40, &v[6], 4);
+  fseek(f, 0, SEEK_SET);
+  fwrite(h, sizeof(h), 1, f);
+}
+
+//hands the batch to the device ring or the wav file
+static void flush() {
+  if (wav) {
+    wavbytes += fwrite(batch, 2, batched, wav) * 2;
+  } else {
+    unsigned tail = atomic_load_explicit(&ring.tail, memory_order_relaxed);
+    unsigned head = atomic_load_explicit(&ring.head, memory_order_acquire);
+    for (uint32_t i = 0; i < batched && tail - head < AUDIO_RING; i++) {
+      ring.samples[tail++ & (AUDIO_RING - 1)] = batch[i];
+    }
+    atomic_store_explicit(&ring.tail, tail, memory_order_release);
+  }
+  batched = 0;
+}
+
+//a forked clone neither owns the audio device nor the parent's wav file
+static void forked() {
+  running = 0;
+  wav = NULL;
+}
+
+//wavpath NULL plays through SDL. Rendering starts at cycle now
+int audiostart(const char *wavpath, uint64_t cpuhz, uint32_t rate, uint64_t now) {
+  static uint8_t registered;
+  if (!registered++) pthread_atfork(NULL, NULL, forked);
+
+  nominal = step = (int64_t)((cpuhz << 16) / rate);
+  synced = now;
+
+  if (wavpath) {
+    wav = fopen(wavpath, "wb");
+    if (!wav) return -1;
+    wavrate = rate;
+    wavheader(wav, rate, 0);
+  } else {
+    SDL_AudioSpec want = {0}, have;
+    if (SDL_InitSubSystem(SDL_INIT_AUDIO) < 0) return -1;
+    want.freq = rate;
+    want.format = AUDIO_S16SYS;
+    want.channels = 1;
+    want.samples = AUDIO_DEVICE;
+    want.callback = callback;
+    device = SDL_OpenAudioDevice(NULL, 0, &want, &have, 0);
+    if (!device) return -1;
+    SDL_PauseAudioDevice(device, 0);
+  }
+  running = 1;
+  return 0;
+}
+
+void audiostop() {
+  if (!running) return;
+  running = 0;
+  flush();
+  if (wav) {
+    wavheader(wav, wavrate, wavbytes);
+    fclose(wav);
+  } else SDL_CloseAudioDevice(device);
+}
+
+static int64_t edges(Audio_Channel *c, int64_t cycles) {
+  int64_t half = (int64_t)c->period * AUDIO_PRESCALE << 16;
+  c->count -= cycles;
+  if (c->count > 0) return 0;
+  int64_t n = -c->count / half + 1;
+  c->count += n * half;
+  return n;
+}
+
+//renders samples up to cycle now with the current register values
+void audiosync(uint64_t now) {
+  //the cpus take turns within a slice, so a write may be a few cycles
+  //behind the last sync; it then lands at the sync point
+  if (now <= synced) return;
+  int64_t cycles = (int64_t)(now - synced) << 16;
+  synced = now;
+  if (!running) return;
+
+  phase += cycles;
+  while (phase >= step) {
+    phase -= step;
+
+    int32_t mix = 0;
+    for (int i = 0; i < 3; i++) {
+      Audio_Channel *c = &channel[i];
+      if (!c->period) continue;
+      int64_t n = edges(c, step);
+      if (i < 2) c->out ^= n & 1;
+      else while (n--) {
+        lfsr = (lfsr >> 1) | (((lfsr ^ (lfsr >> 1)) & 1) << 14);
+        c->out = lfsr & 1;
+      }
+      mix += c->out ? c->volume : -c->volume;
+    }
+
+    batch[batched++] = (int16_t)(mix * 32767 / 45);
+    if (batched == AUDIO_BATCH) flush();
+  }
+}
+
+//frame boundary: render, flush and steer the rate towards AUDIO_TARGET
+void audioframe(uint64_t now) {
+  audiosync(now);
+  if (!running) return;
+  flush();
+  if (wav) return;
+
+  unsigned fill = atomic_load_explicit(&ring.tail, memory_order_relaxed) - atomic_load_explicit(&ring.head, memory_order_acquire);
+  double error = ((double)fill - AUDIO_TARGET) / AUDIO_TARGET;
+  if (error > 1) error = 1;
+  if (error < -1) error = -1;
+  //a full ring means we produce too fast: take more cycles per sample
+  step = nominal + (int64_t)(nominal * AUDIO_SLEW * error);
+}
+
+uint8_t audioread(uint8_t reg) {
+  return regs[reg & 7];
+}
+
+void audiowrite(uint8_t reg, uint8_t value, uint64_t now) {
+  audiosync(now);
+  reg &= 7;
+  regs[reg] = value;
+
+  channel[0].period = regs[AUDIO_TONE0_LO] | (regs[AUDIO_TONE0_HI] << 8);
+  channel[1].period = regs[AUDIO_TONE1_LO] | (regs[AUDIO_TONE1_HI] << 8);
+  channel[2].period = regs[AUDIO_NOISE];
+  channel[0].volume = regs[AUDIO_VOLUME0] & 0xF;
+  channel[1].volume = regs[AUDIO_VOLUME1] & 0xF;
+  channel[2].volume = regs[AUDIO_VOLUMEN] & 0xF;
+}
@@ -0,0 +1,21 @@
+//tone and noise generator, see audio.c
+
+#define AUDIO_BASE 0x2300 //registers at $2300-$2307
+
+#define AUDIO_TONE0_LO 0x0 //tone periods in units of AUDIO_PRESCALE cycles, 0 is silent
+#define AUDIO_TONE0_HI 0x1
+#define AUDIO_TONE1_LO 0x2
+#define AUDIO_TONE1_HI 0x3
+#define AUDIO_NOISE    0x4 //noise shift period, same units
+#define AUDIO_VOLUME0  0x5 //volumes 0-15
+#define AUDIO_VOLUME1  0x6
+#define AUDIO_VOLUMEN  0x7
+
+#define AUDIO_PRESCALE 16
+
+int audiostart(const char *wavpath, uint64_t cpuhz, uint32_t rate, uint64_t now);
+void audiostop();
+void audiosync(uint64_t now);
+void audioframe(uint64_t now);
+uint8_t audioread(uint8_t reg);
+void audiowrite(uint8_t reg, uint8_t value, uint64_t now);
@@ -0,0 +1,65 @@
+/* Copy-on-write machine clones.
+ *
+ * A machine's state is spread over globals in every module: cpu, ram, rom,
+ * the framebuffer and pixel cursor, the scheduler heap, the device
+ * registers. Rather than copying each of them, a clone is a fork(), so the
+ * kernel shares every page copy-on-write between the parent and its
+ * clones, and a clone only costs memory for the pages it writes.
+ *
+ * Threads do not survive fork(). The modules that own one (trace.c,
+ * telemetry.c, audio.c) register pthread_atfork() handlers that turn them
+ * off in the child without touching the parent's files; a clone can start
+ * its own. Clones should run headless, they must not share the window.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "clone.h"
+#include "telemetry.h"
+
+static pid_t children[CLONE_MAX];
+static uint32_t cloned;
+
+//forks count clones of the running machine. Returns their index, 1 to
+//count, in each clone and 0 in the parent; ns gets the time spent forking
+uint32_t clonemachines(uint32_t count, uint64_t *ns) {
+  uint64_t start;
+  int gate[2];
+  char c;
+
+  if (count > CLONE_MAX - cloned) count = CLONE_MAX - cloned;
+  fflush(NULL); //or buffered output is printed once per clone
+  if (pipe(gate)) return 0;
+
+  start = telemetrynow();
+  for (uint32_t i = 1; i <= count; i++) {
+    pid_t pid = fork();
+    if (pid == 0) {
+      //hold until every clone exists, so they don't slow down the forking
+      close(gate[1]);
+      while (read(gate[0], &c, 1) > 0);
+      close(gate[0]);
+      cloned = 0;
+      return i;
+    }
+    if (pid > 0) children[cloned++] = pid;
+  }
+  if (ns) *ns = telemetrynow() - start;
+  close(gate[0]);
+  close(gate[1]);
+  return 0;
+}
+
+//waits for every clone, returns how many did not exit cleanly
+uint32_t clonewait() {
+  uint32_t failed = 0;
+
+  for (uint32_t i = 0; i < cloned; i++) {
+    int status;
+    if (waitpid(children[i], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status)) failed++;
+  }
+  cloned = 0;
+  return failed;
+}
@@ -0,0 +1,6 @@
+//copy-on-write machine clones, see clone.c
+
+#define CLONE_MAX 1024
+
+uint32_t clonemachines(uint32_t count, uint64_t *ns);
+uint32_t clonewait();
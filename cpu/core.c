@@ -0,0 +1,128 @@
+/* Core variant dispatch.
+ *
+ * 6502.c is compiled once per variant (core_nmos.c, core_2a03.c,
+ * core_strict.c, core_65c02.c), each with its dead branches compiled out. The
+ * unsuffixed functions here forward to the variant selected by cpu.core,
+ * so one binary can run boards mixing variants. Dispatch happens once per
+ * call, so prefer exec6502()/run6502() over step6502() in hot loops.
+ *
+ * Built with -DRECOMPILED, the "recomp" variant produced by recomp.c is
+ * available too, and is picked for the ROM it was compiled from.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cpu.h"
+#include "disasm.h"
+
+CPU_State cpu = {0};
+
+typedef struct {
+  const char *name;
+  void (*reset)();
+  void (*step)();
+  void (*exec)(uint32_t tickcount);
+  void (*run)(uint64_t deadline);
+  void (*irq)();
+  void (*nmi)();
+} CPU_Core;
+
+#define COREDECL(v) \
+  extern void reset6502_##v(); \
+  extern void step6502_##v(); \
+  extern void exec6502_##v(uint32_t tickcount); \
+  extern void run6502_##v(uint64_t deadline); \
+  extern void irq6502_##v(); \
+  extern void nmi6502_##v();
+
+#define COREENTRY(v) { #v, reset6502_##v, step6502_##v, exec6502_##v, run6502_##v, irq6502_##v, nmi6502_##v }
+
+COREDECL(nmos)
+COREDECL(2a03)
+COREDECL(strict)
+COREDECL(65c02)
+#ifdef RECOMPILED
+COREDECL(recomp)
+extern int recompiledrom(const uint8_t *rom, uint32_t size);
+#endif
+
+static const CPU_Core cores[CORE_VARIANTS] = {
+  [CORE_NMOS] = COREENTRY(nmos),
+  [CORE_2A03] = COREENTRY(2a03),
+  [CORE_STRICT] = COREENTRY(strict),
+  [CORE_65C02] = COREENTRY(65c02),
+#ifdef RECOMPILED
+  [CORE_RECOMP] = COREENTRY(recomp),
+#endif
+};
+
+void reset6502() {
+  cores[cpu.core].reset();
+}
+
+void step6502() {
+  cores[cpu.core].step();
+}
+
+void exec6502(uint32_t tickcount) {
+  cores[cpu.core].exec(tickcount);
+}
+
+void run6502(uint64_t deadline) {
+  cores[cpu.core].run(deadline);
+}
+
+void irq6502() {
+  cores[cpu.core].irq();
+}
+
+void nmi6502() {
+  cores[cpu.core].nmi();
+}
+
+//CORE_* variant called name, or -1
+int corebyname(const char *name) {
+  for (int i = 0; i < CORE_VARIANTS; i++) {
+    if (cores[i].name && !strcmp(cores[i].name, name)) return i;
+  }
+  return -1;
+}
+
+//the fastest variant that can run rom, mapped at base and entered at
+//entries, exactly, assuming it does not generate code at run time. The
+//decimal flag can only be set by sed, plp or rti; if none of those is
+//reachable BCD can never be active and the 2a03 core is safe. Code the
+//recovery cannot follow (indirect jumps, brk, jumps out of the rom) might
+//reach one, so it falls back to NMOS. Recovery also takes every rts back
+//to a jsr, which only holds while nothing else writes the stack: once
+//reachable code pushes (pha, php) or moves it (txs) and returns, an rts
+//could go anywhere, so then any sed, plp or rti byte in the whole rom
+//counts. 65C02 code is never guessed, it needs CORE_65C02 asked for by name.
+int coreforrom(const uint8_t *rom, uint16_t base, uint32_t size, const uint16_t *entries, int count) {
+  uint8_t *decoded;
+  uint8_t pushes = 0, returns = 0;
+  int core = CORE_2A03;
+
+#ifdef RECOMPILED
+  if (recompiledrom(rom, size)) return CORE_RECOMP;
+#endif
+  decoded = calloc(size, 1);
+  disasmcore(CORE_NMOS);
+  if (recover6502(rom, base, size, entries, count, decoded, NULL)) core = CORE_NMOS;
+  for (uint32_t i = 0; i < size; i++) {
+    const char *op = opname6502(rom[i]);
+    if (!decoded[i]) continue;
+    pushes |= !strcmp(op, "pha") || !strcmp(op, "php") || !strcmp(op, "txs");
+    returns |= !strcmp(op, "rts");
+  }
+  for (uint32_t i = 0; i < size && core == CORE_2A03; i++) {
+    const char *op = opname6502(rom[i]);
+    if ((decoded[i] || (pushes && returns)) && (!strcmp(op, "sed") || !strcmp(op, "plp") || !strcmp(op, "rti"))) {
+      core = CORE_NMOS;
+    }
+  }
+  free(decoded);
+  return core;
+}
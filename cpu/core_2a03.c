@@ -0,0 +1,5 @@
+//Ricoh 2A03: undocumented opcodes, no BCD
+#define CORE 2a03
+#define UNDOCUMENTED
+#define NES_CPU
+#include "6502.c"
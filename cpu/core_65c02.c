@@ -0,0 +1,4 @@
+//WDC 65C02: BCD, the CMOS opcodes, wai and stp
+#define CORE 65c02
+#define CMOS
+#include "6502.c"
@@ -0,0 +1,4 @@
+//NMOS 6502: BCD and undocumented opcodes
+#define CORE nmos
+#define UNDOCUMENTED
+#include "6502.c"
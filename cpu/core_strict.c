@@ -0,0 +1,3 @@
+//NMOS 6502 with BCD, undocumented opcodes act as NOPs
+#define CORE strict
+#include "6502.c"
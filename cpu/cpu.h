@@ -1,13 +1,62 @@
+//6502 status flags
+#define FLAG_CARRY     0x01
+#define FLAG_ZERO      0x02
+#define FLAG_INTERRUPT 0x04
+#define FLAG_DECIMAL   0x08
+#define FLAG_BREAK     0x10
+#define FLAG_CONSTANT  0x20
+#define FLAG_OVERFLOW  0x40
+#define FLAG_SIGN      0x80
+
+//core variants, see core.c
+#define CORE_NMOS      0 //NMOS 6502 with BCD and undocumented opcodes
+#define CORE_2A03      1 //Ricoh 2A03, no BCD
+#define CORE_STRICT    2 //NMOS 6502 with BCD, undocumented opcodes act as NOPs
+#define CORE_65C02     3 //WDC 65C02, with wai and stp
+#define CORE_RECOMP    4 //a ROM recompiled to C by recomp.c, when built in
+#define CORE_VARIANTS  5
+
+//cpu.halt, only ever set by the 65C02's wai and stp
+#define HALT_WAI       1 //until irq6502() or nmi6502()
+#define HALT_STP       2 //until reset6502()
+
 typedef struct {
   uint64_t id;
+  uint8_t core; //which CORE_* variant runs this cpu
   //6502 CPU registers
   uint16_t pc;
   uint8_t sp, a, x, y, status;
-
+  uint8_t halt; //HALT_* when parked
 
   //helper variables
   uint32_t instructions; //keep track of total instructions executed
-  uint32_t clockticks6502, clockgoal6502;
+  uint64_t clockticks6502, clockgoal6502;
   uint16_t oldpc, ea, reladdr, value, result;
   uint8_t opcode, oldstatus;
 } CPU_State;
+
+//structure-of-arrays state for running many CPUs in lockstep, see lockstep.c
+#define LANE_GROUP 32
+#define LANE_RAM 0x800 //bytes of ram each lane owns, the rom above is shared
+#define LANE_STARVE 16 //issues a lane may wait before its pc is issued
+
+typedef struct {
+  uint32_t count; //number of live lanes, arrays are padded to a multiple of LANE_GROUP
+  uint32_t groups;
+  uint8_t core; //CORE_* variant shared by all lanes
+
+  uint64_t *id;
+  uint16_t *pc;
+  uint8_t *sp, *a, *x, *y, *status;
+  uint32_t *instructions;
+  uint64_t *clockticks6502;
+  uint8_t *ram; //LANE_RAM bytes per lane
+
+  //issue fairness
+  uint32_t *waiting; //per lane: issues since the lane last took part
+  uint32_t *oldest; //per group: lane to issue next, or LANE_GROUP for the lowest pc
+
+  //occupancy bookkeeping
+  uint64_t *issued; //per group: instructions issued for the group
+  uint64_t *ran; //per lane: instructions the lane took part in
+} CPU_Lanes;
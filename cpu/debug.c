@@ -0,0 +1,212 @@
+/* Breakpoints, watchpoints and the debugger prompt.
+ *
+ * Nothing here runs per instruction. Setting a breakpoint or watchpoint
+ * marks its page in traps[] and rebuilds the board's memory map, which then
+ * sends accesses to that page (opcode fetches for TRAP_EXEC, reads and
+ * writes for the others) down its slow path into debugfetch(), debugread()
+ * or debugwrite(). Recompiled code does not run blocks on exec-trapped
+ * pages either. Everything on other pages keeps running at full speed.
+ *
+ * Breakpoints stop before the instruction runs, so they must be set on the
+ * first byte of an instruction. Watchpoints stop during the instruction
+ * that makes the access, before it happens. Stepping traps every page.
+ * TRAP_LOG points never stop: each write is printed with the cpu's cycle
+ * count and the cycles since that cpu's previous logged write.
+ *
+ * The prompt reads commands from stdin:
+ *
+ *   c                  continue
+ *   s                  step one instruction
+ *   r                  registers
+ *   m <addr> [count]   dump memory
+ *   d [addr] [count]   disassemble, from pc by default
+ *   b <addr>           toggle a breakpoint
+ *   w <addr> [r|w|rw]  toggle a watchpoint, rw by default
+ *   q                  quit
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cpu.h"
+#include "debug.h"
+#include "disasm.h"
+
+extern CPU_State cpu;
+extern void mapmemory();
+extern uint8_t peek6502(uint16_t address);
+
+typedef struct {
+  uint16_t address;
+  uint8_t kind; //TRAP_* bits, 0 for a free slot
+} Debug_Point;
+
+uint8_t traps[256];
+
+static Debug_Point points[DEBUG_POINTS];
+static uint8_t stepping;
+
+static void retrap() {
+  memset(traps, stepping ? TRAP_EXEC : 0, sizeof(traps));
+  for (int i = 0; i < DEBUG_POINTS; i++) {
+    if (points[i].kind) traps[points[i].address >> 8] |= points[i].kind;
+  }
+  mapmemory();
+}
+
+//sets kind (TRAP_* bits) at address, or clears it if all of it is set.
+//Returns 0 if it is now cleared
+//and -1 when all DEBUG_POINTS slots are taken
+int debugpoint(uint16_t address, uint8_t kind) {
+  Debug_Point *slot = NULL;
+
+  for (int i = 0; i < DEBUG_POINTS; i++) {
+    if (points[i].kind && points[i].address == address) {
+      if ((points[i].kind & kind) == kind) points[i].kind &= ~kind;
+      else points[i].kind |= kind;
+      retrap();
+      return points[i].kind & kind;
+    }
+    if (!points[i].kind && !slot) slot = &points[i];
+  }
+  if (!slot) return -1;
+  slot->address = address;
+  slot->kind = kind;
+  retrap();
+  return kind;
+}
+
+//stop before the next instruction of any cpu
+void debugstep() {
+  stepping = 1;
+  retrap();
+}
+
+static uint8_t hit(uint16_t address, uint8_t kind) {
+  for (int i = 0; i < DEBUG_POINTS; i++) {
+    if ((points[i].kind & kind) && points[i].address == address) return 1;
+  }
+  return 0;
+}
+
+static void registers(uint16_t pc) {
+  printf("cpu%llu PC:%04X A:%02X X:%02X Y:%02X SP:%02X P:%02X  %llu cycles, %u instructions%s\n",
+      (unsigned long long)cpu.id, pc, cpu.a, cpu.x, cpu.y, cpu.sp, cpu.status,
+      (unsigned long long)cpu.clockticks6502, cpu.instructions,
+      cpu.halt == HALT_WAI ? ", waiting" : cpu.halt == HALT_STP ? ", stopped" : "");
+}
+
+static void dump(uint16_t address, uint32_t count) {
+  for (uint32_t i = 0; i < count; i++) {
+    if (!(i & 15)) printf("%s%04X:", i ? "\n" : "", (uint16_t)(address + i));
+    printf(" %02X", peek6502(address + i));
+  }
+  printf("\n");
+}
+
+static void disassemble(uint16_t address, uint32_t count) {
+  char text[32];
+
+  disasmcore(cpu.core);
+  while (count--) {
+    uint8_t bytes[3] = { peek6502(address), peek6502(address + 1), peek6502(address + 2) };
+    uint32_t len = disasm6502(address, bytes, text, sizeof(text));
+
+    printf("%s%04X:", hit(address, TRAP_EXEC) ? "*" : " ", address);
+    for (uint32_t i = 0; i < 3; i++) {
+      if (i < len) printf(" %02X", bytes[i]);
+      else printf("   ");
+    }
+    printf("  %s\n", text);
+    address += len;
+  }
+}
+
+static void report(const char *what, unsigned address, int set) {
+  printf("%s at %04X %s\n", what, address, set < 0 ? "not set, no free slot" : set ? "set" : "cleared");
+}
+
+//pc is where the stopped instruction starts, cpu.pc may be past it
+static void prompt(uint16_t pc) {
+  char line[128], mode[8];
+  unsigned a, n;
+
+  registers(pc);
+  disassemble(pc, 1);
+  while (1) {
+    printf("> ");
+    fflush(stdout);
+    if (!fgets(line, sizeof(line), stdin)) finish();
+
+    switch (line[0]) {
+      case 'c':
+        return;
+      case 's':
+        debugstep();
+        return;
+      case 'r':
+        registers(pc);
+        break;
+      case 'm':
+        n = 64;
+        if (sscanf(line + 1, "%x %u", &a, &n) < 1) printf("m <addr> [count]\n");
+        else dump(a, n);
+        break;
+      case 'd':
+        a = pc;
+        n = 8;
+        sscanf(line + 1, "%x %u", &a, &n);
+        disassemble(a, n);
+        break;
+      case 'b':
+        if (sscanf(line + 1, "%x", &a) != 1) printf("b <addr>\n");
+        else report("breakpoint", a, debugpoint(a, TRAP_EXEC));
+        break;
+      case 'w': {
+        uint8_t kind = TRAP_READ | TRAP_WRITE;
+        int got = sscanf(line + 1, "%x %7s", &a, mode);
+        if (got < 1) {
+          printf("w <addr> [r|w|rw]\n");
+          break;
+        }
+        if (got == 2) kind = (strchr(mode, 'r') ? TRAP_READ : 0) | (strchr(mode, 'w') ? TRAP_WRITE : 0);
+        if (kind) report("watchpoint", a, debugpoint(a, kind));
+        break;
+      }
+      case 'q':
+        finish();
+      default:
+        printf("c, s, r, m <addr> [count], d [addr] [count], b <addr>, w <addr> [r|w|rw], q\n");
+    }
+  }
+}
+
+//opcode fetch from an exec-trapped page
+void debugfetch(uint16_t address) {
+  if (stepping) {
+    stepping = 0;
+    retrap();
+  } else if (!hit(address, TRAP_EXEC)) return;
+  prompt(address);
+}
+
+void debugread(uint16_t address) {
+  if (!hit(address, TRAP_READ)) return;
+  printf("read of %04X by the instruction before pc\n", address);
+  prompt(cpu.pc);
+}
+
+void debugwrite(uint16_t address, uint8_t value) {
+  static uint64_t logged[2]; //cycle of each cpu's previous logged write
+
+  if (hit(address, TRAP_LOG)) {
+    uint64_t *last = &logged[(cpu.id - 1) & 1];
+    printf("cpu%llu wrote %02X to %04X at cycle %llu, %llu since its last\n", (unsigned long long)cpu.id,
+        value, address, (unsigned long long)cpu.clockticks6502, (unsigned long long)(cpu.clockticks6502 - *last));
+    *last = cpu.clockticks6502;
+  }
+  if (!hit(address, TRAP_WRITE)) return;
+  printf("write of %02X to %04X by the instruction before pc\n", value, address);
+  prompt(cpu.pc);
+}
@@ -0,0 +1,20 @@
+//breakpoints, watchpoints and the debugger prompt, see debug.c
+
+//traps bits
+#define TRAP_EXEC  0x01
+#define TRAP_READ  0x02
+#define TRAP_WRITE 0x04
+#define TRAP_LOG   0x08 //writes are logged with their cycle and carry on
+
+#define DEBUG_POINTS 64
+
+extern uint8_t traps[256]; //per 256-byte page, what the memory map sends to the debugger
+
+//supplied by the board: stops audio, telemetry and tracing, then exits
+__attribute__((noreturn)) void finish();
+
+int debugpoint(uint16_t address, uint8_t kind);
+void debugstep();
+void debugfetch(uint16_t address);
+void debugread(uint16_t address);
+void debugwrite(uint16_t address, uint8_t value);
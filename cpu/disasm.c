@@ -0,0 +1,200 @@
+/* Disassembly from the core's own tables.
+ *
+ * Includes 6502.c (as the otherwise unused "disasm" variant, with the
+ * undocumented opcodes named and the 65C02 tables compiled in) only to
+ * read addrtable, optable and ticktable, so the debugger and recomp.c agree
+ * with the core by construction. Handler and mode names are the function
+ * names in 6502.c. disasmcore() picks the 65C02 tables or the NMOS ones.
+ * recover6502() finds the code in a ROM image for recomp.c and core.c.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "disasm.h"
+
+#define CORE disasm
+#define UNDOCUMENTED
+#define CMOS_TABLES
+#include "6502.c"
+
+#define NAMED(f) { f, #f }
+
+typedef struct {
+  void (*fn)();
+  const char *name;
+} Named;
+
+static const Named modes[] = {
+  NAMED(imp), NAMED(acc), NAMED(imm), NAMED(zp), NAMED(zpx), NAMED(zpy), NAMED(rel),
+  NAMED(abso), NAMED(absx), NAMED(absy), NAMED(ind), NAMED(indx), NAMED(indy),
+  NAMED(zpi), NAMED(ainx), NAMED(zprel),
+};
+
+static const Named ops[] = {
+  NAMED(adc), NAMED(and), NAMED(asl), NAMED(bcc), NAMED(bcs), NAMED(beq), NAMED(bit), NAMED(bmi),
+  NAMED(bne), NAMED(bpl), NAMED(brk), NAMED(bvc), NAMED(bvs), NAMED(clc), NAMED(cld), NAMED(cli),
+  NAMED(clv), NAMED(cmp), NAMED(cpx), NAMED(cpy), NAMED(dec), NAMED(dex), NAMED(dey), NAMED(eor),
+  NAMED(inc), NAMED(inx), NAMED(iny), NAMED(jmp), NAMED(jsr), NAMED(lda), NAMED(ldx), NAMED(ldy),
+  NAMED(lsr), NAMED(nop), NAMED(ora), NAMED(pha), NAMED(php), NAMED(pla), NAMED(plp), NAMED(rol),
+  NAMED(ror), NAMED(rti), NAMED(rts), NAMED(sbc), NAMED(sec), NAMED(sed), NAMED(sei), NAMED(sta),
+  NAMED(stx), NAMED(sty), NAMED(tax), NAMED(tay), NAMED(tsx), NAMED(txa), NAMED(txs), NAMED(tya),
+  NAMED(lax), NAMED(sax), NAMED(dcp), NAMED(isb), NAMED(slo), NAMED(rla), NAMED(sre), NAMED(rra),
+  NAMED(bra), NAMED(bbr), NAMED(bbs), NAMED(rmb), NAMED(smb), NAMED(phx), NAMED(phy), NAMED(plx),
+  NAMED(ply), NAMED(stz), NAMED(trb), NAMED(tsb), NAMED(wai), NAMED(stp),
+};
+
+//tables of the selected core
+static void (**modetable)() = addrtable;
+static void (**handlertable)() = optable;
+static const uint32_t *cycletable = ticktable;
+
+static const char *name(const Named *table, size_t n, void (*fn)()) {
+  for (size_t i = 0; i < n; i++) {
+    if (table[i].fn == fn) return table[i].name;
+  }
+  return "???";
+}
+
+//decode for core (a CORE_* variant) from now on
+void disasmcore(uint8_t core) {
+  modetable = core == CORE_65C02 ? addrtable65c02 : addrtable;
+  handlertable = core == CORE_65C02 ? optable65c02 : optable;
+  cycletable = core == CORE_65C02 ? ticktable65c02 : ticktable;
+}
+
+//handler name, e.g. "lda"
+const char *opname6502(uint8_t opcode) {
+  return name(ops, sizeof(ops) / sizeof(ops[0]), handlertable[opcode]);
+}
+
+//addressing mode name, e.g. "absx"
+const char *modename6502(uint8_t opcode) {
+  return name(modes, sizeof(modes) / sizeof(modes[0]), modetable[opcode]);
+}
+
+uint32_t length6502(uint8_t opcode) {
+  void (*m)() = modetable[opcode];
+  if (m == imp || m == acc) return 1;
+  if (m == abso || m == absx || m == absy || m == ind || m == ainx || m == zprel) return 3;
+  return 2;
+}
+
+//base cycles, before page crossing and branch penalties
+uint32_t ticks6502(uint8_t opcode) {
+  return cycletable[opcode];
+}
+
+//formats the instruction in bytes (at least length6502() of them) as it
+//would sit at address, returns its length
+uint32_t disasm6502(uint16_t address, const uint8_t *bytes, char *out, size_t size) {
+  uint8_t op = bytes[0];
+  void (*m)() = modetable[op];
+  uint16_t w = bytes[1] | (bytes[2] << 8);
+  const char *n = opname6502(op);
+  char bit[8];
+
+  //rmb, smb, bbr and bbs carry their bit number in the opcode
+  if (handlertable[op] == rmb || handlertable[op] == smb || m == zprel) {
+    snprintf(bit, sizeof(bit), "%s%u", n, (op >> 4) & 7);
+    n = bit;
+  }
+
+  if (m == imp) snprintf(out, size, "%s", n);
+  else if (m == acc) snprintf(out, size, "%s a", n);
+  else if (m == imm) snprintf(out, size, "%s #$%02X", n, bytes[1]);
+  else if (m == zp) snprintf(out, size, "%s $%02X", n, bytes[1]);
+  else if (m == zpx) snprintf(out, size, "%s $%02X,x", n, bytes[1]);
+  else if (m == zpy) snprintf(out, size, "%s $%02X,y", n, bytes[1]);
+  else if (m == rel) snprintf(out, size, "%s $%04X", n, (uint16_t)(address + 2 + (int8_t)bytes[1]));
+  else if (m == abso) snprintf(out, size, "%s $%04X", n, w);
+  else if (m == absx) snprintf(out, size, "%s $%04X,x", n, w);
+  else if (m == absy) snprintf(out, size, "%s $%04X,y", n, w);
+  else if (m == ind) snprintf(out, size, "%s ($%04X)", n, w);
+  else if (m == indx) snprintf(out, size, "%s ($%02X,x)", n, bytes[1]);
+  else if (m == zpi) snprintf(out, size, "%s ($%02X)", n, bytes[1]);
+  else if (m == ainx) snprintf(out, size, "%s ($%04X,x)", n, w);
+  else if (m == zprel) snprintf(out, size, "%s $%02X,$%04X", n, bytes[1], (uint16_t)(address + 3 + (int8_t)bytes[2]));
+  else snprintf(out, size, "%s ($%02X),y", n, bytes[1]);
+  return length6502(op);
+}
+
+static int within(uint32_t address, uint32_t base, uint32_t size) {
+  return address >= base && address < base + size;
+}
+
+static int isbranch(uint8_t op) {
+  return modetable[op] == rel || modetable[op] == zprel;
+}
+
+//instructions after which the next pc is not simply the following byte
+static int endsblock(uint8_t op) {
+  void (*h)() = handlertable[op];
+  return isbranch(op) || h == jmp || h == jsr || h == rts || h == rti || h == brk || h == stp;
+}
+
+//follows every path reachable from entries through image, mapped at base,
+//marking in decoded[] each instruction start and in leader[] (if not NULL)
+//each entry, branch or jump target and return point. Branches fall through
+//and subroutines are assumed to return. Returns how many exits could not be
+//followed: indirect jumps, brk, and paths that leave the image
+uint32_t recover6502(const uint8_t *image, uint32_t base, uint32_t size, const uint16_t *entries, int count,
+    uint8_t *decoded, uint8_t *leader) {
+  uint32_t *work = malloc((size * 2 + count) * sizeof(uint32_t));
+  uint32_t n = 0, lost = 0;
+
+  for (int i = 0; i < count; i++) {
+    if (!within(entries[i], base, size)) {
+      lost++;
+      continue;
+    }
+    if (leader) leader[entries[i] - base] = 1;
+    work[n++] = entries[i];
+  }
+
+  while (n) {
+    uint32_t pc = work[--n];
+
+    while (!within(pc, base, size) || !decoded[pc - base]) {
+      uint8_t op;
+      uint32_t next;
+      int32_t target = -1;
+      void (*h)(), (*m)();
+
+      if (!within(pc, base, size) || !within(pc + length6502(image[pc - base]) - 1, base, size)) {
+        lost++;
+        break;
+      }
+      op = image[pc - base];
+      next = pc + length6502(op);
+      decoded[pc - base] = 1;
+      if (!endsblock(op)) {
+        pc = next;
+        continue;
+      }
+
+      h = handlertable[op];
+      m = modetable[op];
+      if (h == brk || m == ind || m == ainx) lost++;
+      else if (m == rel) target = (next + (int8_t)image[pc + 1 - base]) & 0xFFFF;
+      else if (m == zprel) target = (next + (int8_t)image[pc + 2 - base]) & 0xFFFF;
+      else if (m == abso && (h == jmp || h == jsr)) target = image[pc + 1 - base] | (image[pc + 2 - base] << 8);
+      if (target >= 0) {
+        if (within(target, base, size)) {
+          if (leader) leader[target - base] = 1;
+          work[n++] = target;
+        } else lost++;
+      }
+      if ((isbranch(op) && h != bra) || h == jsr) {
+        if (within(next, base, size)) {
+          if (leader) leader[next - base] = 1;
+          work[n++] = next;
+        } else lost++;
+      }
+      break;
+    }
+  }
+  free(work);
+  return lost;
+}
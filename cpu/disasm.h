@@ -0,0 +1,10 @@
+//disassembly from the core's own tables, see disasm.c
+
+void disasmcore(uint8_t core);
+const char *opname6502(uint8_t opcode);
+const char *modename6502(uint8_t opcode);
+uint32_t length6502(uint8_t opcode);
+uint32_t ticks6502(uint8_t opcode);
+uint32_t disasm6502(uint16_t address, const uint8_t *bytes, char *out, size_t size);
+uint32_t recover6502(const uint8_t *image, uint32_t base, uint32_t size, const uint16_t *entries, int count,
+    uint8_t *decoded, uint8_t *leader);
@@ -0,0 +1,68 @@
+; Mailbox doorbell interrupt demo (see mailbox.c).
+;
+; cpu1 rings cpu2's doorbell, then waits until cpu2 has seen the ring.
+; cpu2 enables the doorbell irq and idles; its irq handler reads DOORBELL
+; (which clears the bits and drops the line), counts the ring and returns
+; with rti. Back in its idle loop cpu2 notices the new count and writes it
+; to $2000, so every write there is proof that an irq was taken and
+; returned from. Run it with
+;
+;   ./main --headless --rom=doorbell --cycles=100000 --log-write=2000
+;
+; which should print $01, $02, $03, ... written by cpu2, one per ring.
+
+MAILBOX_DOORBELL = $2102
+MAILBOX_CTRL     = $2103
+MAILBOX_IRQBELL  = $01
+
+owner = $10 ; set once a cpu has claimed the ringing side
+rung  = $11 ; rings sent by cpu1
+taken = $12 ; irqs taken by cpu2
+seen  = $13 ; irqs cpu2's idle loop has reported
+
+.segment "CODE"
+reset:
+  ldx #$FF
+  txs
+
+  ; both cpus run this rom on the same ram. The board runs cpu1's slice
+  ; first, so cpu1 claims the ringing side before cpu2 starts
+  lda owner
+  bne listen
+  inc owner
+
+ring:
+  inc rung
+  lda #1
+  sta MAILBOX_DOORBELL
+wait:
+  lda seen
+  cmp rung
+  bne wait
+  jmp ring
+
+listen:
+  lda #MAILBOX_IRQBELL
+  sta MAILBOX_CTRL
+  cli
+idle:
+  lda taken
+  cmp seen
+  beq idle
+  sta seen
+  sta $2000
+  jmp idle
+
+irq:
+  pha
+  lda MAILBOX_DOORBELL
+  inc taken
+  pla
+  rti
+
+nmi:
+  rti
+
+; the board always resets to $0800, the reset entry is here for completeness
+.segment "VECTORS"
+  .word nmi, reset, irq
@@ -0,0 +1,135 @@
+/* Controller and keyboard device.
+ *
+ * The guest sees the held buttons at INPUT_PAD and a small fifo of key
+ * codes at INPUT_KEY (see input.h).
+ *
+ * Host events are posted with inputpost() into a lock-free single-producer
+ * single-consumer queue, so they may come from any one host thread. The
+ * emulation thread calls inputdrain() every few thousand cycles from a
+ * scheduled event; it applies each event once the emulated clock reaches
+ * the cycle stamped on it, so input lands at the right emulated time.
+ * Latency from host arrival to the first frame presented after the event
+ * was applied goes to telemetry.
+ *
+ * Scripted input (inputscript()) bypasses the queue: each line
+ *
+ *   <cycle> press|release|type <code>
+ *
+ * becomes a scheduler event at exactly that cycle, so headless benchmark
+ * runs are deterministic.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include "input.h"
+#include "scheduler.h"
+#include "telemetry.h"
+
+#define INPUT_QUEUE 256 //host events in flight, power of two
+#define INPUT_KEYS 16 //guest key fifo, power of two
+
+static struct {
+  _Alignas(64) atomic_uint head;
+  _Alignas(64) atomic_uint tail;
+  Input_Event events[INPUT_QUEUE];
+} queue;
+
+static uint8_t pad;
+static uint8_t keys[INPUT_KEYS];
+static uint8_t keyhead, keytail;
+
+static uint64_t pendingns; //oldest applied host event not yet on screen
+
+//called from the host side, returns 0 when the queue is full
+int inputpost(Input_Event *e) {
+  unsigned tail = atomic_load_explicit(&queue.tail, memory_order_relaxed);
+  unsigned head = atomic_load_explicit(&queue.head, memory_order_acquire);
+  if (tail - head == INPUT_QUEUE) return 0;
+
+  queue.events[tail & (INPUT_QUEUE - 1)] = *e;
+  atomic_store_explicit(&queue.tail, tail + 1, memory_order_release);
+  return 1;
+}
+
+static void apply(Input_Event *e) {
+  switch (e->type) {
+    case INPUT_PRESS:
+      pad |= e->code;
+      break;
+    case INPUT_RELEASE:
+      pad &= ~e->code;
+      break;
+    case INPUT_TYPE:
+      if ((uint8_t)(keytail - keyhead) < INPUT_KEYS) keys[keytail++ & (INPUT_KEYS - 1)] = e->code;
+      break;
+  }
+  if (e->hostns && !pendingns) pendingns = e->hostns;
+}
+
+//applies queued host events that are due at cycle now
+void inputdrain(uint64_t now) {
+  unsigned head = atomic_load_explicit(&queue.head, memory_order_relaxed);
+  unsigned tail = atomic_load_explicit(&queue.tail, memory_order_acquire);
+
+  while (head != tail) {
+    Input_Event *e = &queue.events[head & (INPUT_QUEUE - 1)];
+    if (e->cycle > now) break;
+    apply(e);
+    head++;
+  }
+  atomic_store_explicit(&queue.head, head, memory_order_release);
+}
+
+//a frame reached the screen at host time now
+void inputpresented(uint64_t now) {
+  if (!pendingns) return;
+  telemetryinput(now - pendingns);
+  pendingns = 0;
+}
+
+static void scripted(void *ctx, uint64_t when) {
+  apply((Input_Event *)ctx);
+  free(ctx);
+}
+
+int inputscript(const char *path) {
+  char line[128], type[16];
+  unsigned long long cycle;
+  int code;
+  FILE *f = fopen(path, "r");
+
+  if (!f) return -1;
+  while (fgets(line, sizeof(line), f)) {
+    if (line[0] == '#' || sscanf(line, "%llu %15s %i", &cycle, type, &code) != 3) continue;
+
+    Input_Event *e = calloc(1, sizeof(Input_Event));
+    e->cycle = cycle;
+    e->code = code;
+    if (!strcmp(type, "press")) e->type = INPUT_PRESS;
+    else if (!strcmp(type, "release")) e->type = INPUT_RELEASE;
+    else if (!strcmp(type, "type")) e->type = INPUT_TYPE;
+    else {
+      free(e);
+      continue;
+    }
+    schedule(e->cycle, scripted, e);
+  }
+  fclose(f);
+  return 0;
+}
+
+uint8_t inputread(uint8_t reg) {
+  switch (reg) {
+    case INPUT_PAD:
+      return pad;
+    case INPUT_KEY:
+      if (keyhead == keytail) return 0;
+      return keys[keyhead++ & (INPUT_KEYS - 1)];
+    case INPUT_KEYCOUNT:
+      return keytail - keyhead;
+  }
+  return 0;
+}
@@ -0,0 +1,34 @@
+//controller and keyboard input device, see input.c
+
+#define INPUT_BASE 0x2200 //registers at $2200-$2202
+
+#define INPUT_PAD      0x0 //buttons held, INPUT_* bits
+#define INPUT_KEY      0x1 //read pops the next key code, 0 when empty
+#define INPUT_KEYCOUNT 0x2 //key codes waiting
+
+//INPUT_PAD bits
+#define INPUT_UP     0x01
+#define INPUT_DOWN   0x02
+#define INPUT_LEFT   0x04
+#define INPUT_RIGHT  0x08
+#define INPUT_A      0x10
+#define INPUT_B      0x20
+#define INPUT_SELECT 0x40
+#define INPUT_START  0x80
+
+//event types
+#define INPUT_PRESS   0 //code is an INPUT_* pad bit
+#define INPUT_RELEASE 1
+#define INPUT_TYPE    2 //code is a key code for the keyboard fifo
+
+typedef struct {
+  uint64_t cycle; //emulated cycle the event applies at
+  uint64_t hostns; //host arrival time for latency measurement, 0 for scripted events
+  uint8_t type, code;
+} Input_Event;
+
+int inputpost(Input_Event *e);
+void inputdrain(uint64_t now);
+int inputscript(const char *path);
+void inputpresented(uint64_t now);
+uint8_t inputread(uint8_t reg);
@@ -0,0 +1,364 @@
+/* Lockstep interpreter for many CPUs running the same ROM.
+ *
+ * Lanes are kept in structure-of-arrays form (CPU_Lanes in cpu.h) and
+ * stepped LANE_GROUP at a time. Each step picks the lowest pc in the group,
+ * and every lane sitting on that pc executes the instruction together; the
+ * others are masked off until control flow brings them back (taking the
+ * minimum pc lets lanes that fell behind in a loop catch up). A lane that
+ * never reconverges, say one spinning in a loop below the others, would
+ * starve everything above it, so once a lane has waited LANE_STARVE issues
+ * its pc is issued instead.
+ *
+ * Every lane owns LANE_RAM bytes of ram, so lanes can run on different
+ * inputs. Before a lane runs on the scalar core the board's laneram() points
+ * its ram at the lane's copy; the rom and the devices stay shared. Only
+ * code in the rom is the same for every lane, so the vector path only
+ * issues pcs there.
+ *
+ * Register-only, immediate, jmp and branch opcodes run on the whole group
+ * with AVX2. Everything else, and everything when built without AVX2, is
+ * handed to the scalar step6502() one lane at a time, in lane order, so
+ * results are identical to running each lane through the scalar core.
+ * Scheduled events (schedule()/schedrun()) never fire for lanes, and the
+ * vector path is skipped entirely while tracing so every instruction gets
+ * its record.
+ * Lanes take no interrupts and do not keep cpu.halt, so on the 65C02 core
+ * wai and stp just fall through to the next instruction.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+#include "cpu.h"
+
+extern uint8_t read6502(uint16_t address);
+extern uint8_t fetch6502(uint16_t address);
+extern void step6502();
+extern void reset6502();
+extern void laneram(uint8_t *ram);
+extern CPU_State cpu;
+extern uint8_t tracing;
+
+static void *lanealloc(uint32_t n, size_t size) {
+  void *p = aligned_alloc(32, n * size);
+  memset(p, 0, n * size);
+  return p;
+}
+
+void initlanes(CPU_Lanes *l, uint32_t count) {
+  uint32_t n;
+
+  l->count = count;
+  l->groups = (count + LANE_GROUP - 1) / LANE_GROUP;
+  n = l->groups * LANE_GROUP;
+
+  l->id = lanealloc(n, sizeof(uint64_t));
+  l->pc = lanealloc(n, sizeof(uint16_t));
+  l->sp = lanealloc(n, sizeof(uint8_t));
+  l->a = lanealloc(n, sizeof(uint8_t));
+  l->x = lanealloc(n, sizeof(uint8_t));
+  l->y = lanealloc(n, sizeof(uint8_t));
+  l->status = lanealloc(n, sizeof(uint8_t));
+  l->instructions = lanealloc(n, sizeof(uint32_t));
+  l->clockticks6502 = lanealloc(n, sizeof(uint64_t));
+  l->ram = lanealloc(n, LANE_RAM);
+  l->waiting = lanealloc(n, sizeof(uint32_t));
+  l->oldest = lanealloc(l->groups, sizeof(uint32_t));
+  l->issued = lanealloc(l->groups, sizeof(uint64_t));
+  l->ran = lanealloc(n, sizeof(uint64_t));
+
+  //padding lanes sit at the highest pc so they never lead a group
+  for (uint32_t i = count; i < n; i++) l->pc[i] = 0xFFFF;
+  for (uint32_t g = 0; g < l->groups; g++) l->oldest[g] = LANE_GROUP;
+}
+
+void freelanes(CPU_Lanes *l) {
+  free(l->id);
+  free(l->pc);
+  free(l->sp);
+  free(l->a);
+  free(l->x);
+  free(l->y);
+  free(l->status);
+  free(l->instructions);
+  free(l->clockticks6502);
+  free(l->ram);
+  free(l->waiting);
+  free(l->oldest);
+  free(l->issued);
+  free(l->ran);
+}
+
+static void loadlane(CPU_Lanes *l, uint32_t i) {
+  memset(&cpu, 0, sizeof(cpu));
+  cpu.id = l->id[i];
+  cpu.core = l->core;
+  cpu.pc = l->pc[i];
+  cpu.sp = l->sp[i];
+  cpu.a = l->a[i];
+  cpu.x = l->x[i];
+  cpu.y = l->y[i];
+  cpu.status = l->status[i];
+  cpu.instructions = l->instructions[i];
+  cpu.clockticks6502 = l->clockticks6502[i];
+  cpu.clockgoal6502 = cpu.clockticks6502;
+  laneram(l->ram + (size_t)i * LANE_RAM);
+}
+
+static void storelane(CPU_Lanes *l, uint32_t i) {
+  l->pc[i] = cpu.pc;
+  l->sp[i] = cpu.sp;
+  l->a[i] = cpu.a;
+  l->x[i] = cpu.x;
+  l->y[i] = cpu.y;
+  l->status[i] = cpu.status;
+  l->instructions[i] = cpu.instructions;
+  l->clockticks6502[i] = cpu.clockticks6502;
+}
+
+void resetlanes(CPU_Lanes *l) {
+  for (uint32_t i = 0; i < l->count; i++) {
+    loadlane(l, i);
+    reset6502();
+    storelane(l, i);
+  }
+}
+
+static uint32_t livemask(CPU_Lanes *l, uint32_t g) {
+  uint32_t left = l->count - g * LANE_GROUP;
+  if (left >= LANE_GROUP) return 0xFFFFFFFF;
+  return (1u << left) - 1;
+}
+
+#ifdef __AVX2__
+//expand 32 mask bits into 32 bytes of 0x00/0xFF
+static __m256i expand8(uint32_t bits) {
+  const __m256i shuf = _mm256_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1,
+                                        2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3);
+  const __m256i sel = _mm256_set1_epi64x(0x8040201008040201);
+  __m256i v = _mm256_shuffle_epi8(_mm256_set1_epi32(bits), shuf);
+  return _mm256_cmpeq_epi8(_mm256_and_si256(v, sel), sel);
+}
+
+//expand 16 mask bits into 16 words of 0x0000/0xFFFF
+static __m256i expand16(uint32_t bits) {
+  const __m256i sel = _mm256_setr_epi16(0x0001, 0x0002, 0x0004, 0x0008, 0x0010, 0x0020, 0x0040, 0x0080,
+                                        0x0100, 0x0200, 0x0400, 0x0800, 0x1000, 0x2000, 0x4000, (short)0x8000);
+  __m256i v = _mm256_set1_epi16((short)bits);
+  return _mm256_cmpeq_epi16(_mm256_and_si256(v, sel), sel);
+}
+
+static uint16_t groupminpc(const uint16_t *pc) {
+  __m256i m = _mm256_min_epu16(_mm256_loadu_si256((const __m256i *)pc),
+                               _mm256_loadu_si256((const __m256i *)(pc + 16)));
+  __m128i h = _mm_min_epu16(_mm256_castsi256_si128(m), _mm256_extracti128_si256(m, 1));
+  return (uint16_t)_mm_cvtsi128_si32(_mm_minpos_epu16(h));
+}
+
+static uint32_t groupmask(const uint16_t *pc, uint16_t minpc) {
+  __m256i target = _mm256_set1_epi16((short)minpc);
+  __m256i eq0 = _mm256_cmpeq_epi16(_mm256_loadu_si256((const __m256i *)pc), target);
+  __m256i eq1 = _mm256_cmpeq_epi16(_mm256_loadu_si256((const __m256i *)(pc + 16)), target);
+  __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi16(eq0, eq1), 0xD8);
+  return (uint32_t)_mm256_movemask_epi8(packed);
+}
+
+static __m256i nzflags(__m256i status, __m256i v) {
+  __m256i z = _mm256_and_si256(_mm256_cmpeq_epi8(v, _mm256_setzero_si256()), _mm256_set1_epi8(FLAG_ZERO));
+  __m256i n = _mm256_and_si256(v, _mm256_set1_epi8((char)FLAG_SIGN));
+  status = _mm256_and_si256(status, _mm256_set1_epi8((char)~(FLAG_ZERO | FLAG_SIGN)));
+  return _mm256_or_si256(status, _mm256_or_si256(z, n));
+}
+
+//add per-lane byte tick counts to the 64-bit cycle counters, and count the instruction
+static void addticks(CPU_Lanes *l, uint32_t base, __m256i ticks, __m256i mask) {
+  uint8_t t[LANE_GROUP], m[LANE_GROUP];
+  _mm256_storeu_si256((__m256i *)t, ticks);
+  _mm256_storeu_si256((__m256i *)m, _mm256_and_si256(mask, _mm256_set1_epi8(1)));
+
+  for (uint32_t k = 0; k < LANE_GROUP; k += 4) {
+    __m256i *ct = (__m256i *)(l->clockticks6502 + base + k);
+    int32_t four;
+    memcpy(&four, t + k, sizeof(four));
+    __m256i dt = _mm256_cvtepu8_epi64(_mm_cvtsi32_si128(four));
+    _mm256_storeu_si256(ct, _mm256_add_epi64(_mm256_loadu_si256(ct), dt));
+  }
+  for (uint32_t k = 0; k < LANE_GROUP; k += 8) {
+    __m256i *in = (__m256i *)(l->instructions + base + k);
+    __m256i di = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(m + k)));
+    _mm256_storeu_si256(in, _mm256_add_epi32(_mm256_loadu_si256(in), di));
+  }
+}
+
+static void setpc(CPU_Lanes *l, uint32_t base, uint32_t bits, uint16_t newpc) {
+  __m256i *p0 = (__m256i *)(l->pc + base), *p1 = (__m256i *)(l->pc + base + 16);
+  __m256i v = _mm256_set1_epi16((short)newpc);
+  _mm256_storeu_si256(p0, _mm256_blendv_epi8(_mm256_loadu_si256(p0), v, expand16(bits & 0xFFFF)));
+  _mm256_storeu_si256(p1, _mm256_blendv_epi8(_mm256_loadu_si256(p1), v, expand16(bits >> 16)));
+}
+
+//executes the instruction at the issued pc on every lane in bits, returns 0 if the opcode has no vector form
+static int vectorop(CPU_Lanes *l, uint32_t g, uint16_t minpc, uint32_t bits) {
+  uint32_t base = g * LANE_GROUP;
+  uint8_t opcode = fetch6502(minpc);
+  uint8_t len = 1, ticks = 2;
+  __m256i mask = expand8(bits);
+  __m256i a = _mm256_loadu_si256((const __m256i *)(l->a + base));
+  __m256i x = _mm256_loadu_si256((const __m256i *)(l->x + base));
+  __m256i y = _mm256_loadu_si256((const __m256i *)(l->y + base));
+  __m256i sp = _mm256_loadu_si256((const __m256i *)(l->sp + base));
+  __m256i st = _mm256_loadu_si256((const __m256i *)(l->status + base));
+  __m256i one = _mm256_set1_epi8(1);
+  __m256i na = a, nx = x, ny = y, nsp = sp, nst;
+  uint16_t newpc;
+
+  nst = _mm256_or_si256(st, _mm256_set1_epi8(FLAG_CONSTANT));
+
+  switch (opcode) {
+    case 0xA9: len = 2; na = _mm256_set1_epi8((char)read6502(minpc + 1)); nst = nzflags(nst, na); break; //lda #
+    case 0xA2: len = 2; nx = _mm256_set1_epi8((char)read6502(minpc + 1)); nst = nzflags(nst, nx); break; //ldx #
+    case 0xA0: len = 2; ny = _mm256_set1_epi8((char)read6502(minpc + 1)); nst = nzflags(nst, ny); break; //ldy #
+    case 0x29: len = 2; na = _mm256_and_si256(a, _mm256_set1_epi8((char)read6502(minpc + 1))); nst = nzflags(nst, na); break; //and #
+    case 0x09: len = 2; na = _mm256_or_si256(a, _mm256_set1_epi8((char)read6502(minpc + 1))); nst = nzflags(nst, na); break; //ora #
+    case 0x49: len = 2; na = _mm256_xor_si256(a, _mm256_set1_epi8((char)read6502(minpc + 1))); nst = nzflags(nst, na); break; //eor #
+    case 0xAA: nx = a; nst = nzflags(nst, nx); break; //tax
+    case 0xA8: ny = a; nst = nzflags(nst, ny); break; //tay
+    case 0x8A: na = x; nst = nzflags(nst, na); break; //txa
+    case 0x98: na = y; nst = nzflags(nst, na); break; //tya
+    case 0xBA: nx = sp; nst = nzflags(nst, nx); break; //tsx
+    case 0x9A: nsp = x; break; //txs
+    case 0xE8: nx = _mm256_add_epi8(x, one); nst = nzflags(nst, nx); break; //inx
+    case 0xC8: ny = _mm256_add_epi8(y, one); nst = nzflags(nst, ny); break; //iny
+    case 0xCA: nx = _mm256_sub_epi8(x, one); nst = nzflags(nst, nx); break; //dex
+    case 0x88: ny = _mm256_sub_epi8(y, one); nst = nzflags(nst, ny); break; //dey
+    case 0x18: nst = _mm256_and_si256(nst, _mm256_set1_epi8((char)~FLAG_CARRY)); break; //clc
+    case 0x38: nst = _mm256_or_si256(nst, _mm256_set1_epi8(FLAG_CARRY)); break; //sec
+    case 0x58: nst = _mm256_and_si256(nst, _mm256_set1_epi8((char)~FLAG_INTERRUPT)); break; //cli
+    case 0x78: nst = _mm256_or_si256(nst, _mm256_set1_epi8(FLAG_INTERRUPT)); break; //sei
+    case 0xD8: nst = _mm256_and_si256(nst, _mm256_set1_epi8((char)~FLAG_DECIMAL)); break; //cld
+    case 0xF8: nst = _mm256_or_si256(nst, _mm256_set1_epi8(FLAG_DECIMAL)); break; //sed
+    case 0xB8: nst = _mm256_and_si256(nst, _mm256_set1_epi8((char)~FLAG_OVERFLOW)); break; //clv
+    case 0xEA: break; //nop
+    case 0x4C: //jmp abs
+      newpc = (uint16_t)read6502(minpc + 1) | ((uint16_t)read6502(minpc + 2) << 8);
+      st = _mm256_blendv_epi8(st, nst, mask);
+      _mm256_storeu_si256((__m256i *)(l->status + base), st);
+      setpc(l, base, bits, newpc);
+      addticks(l, base, _mm256_and_si256(mask, _mm256_set1_epi8(3)), mask);
+      return 1;
+    case 0x10: case 0x30: case 0x50: case 0x70: //bpl bmi bvc bvs
+    case 0x90: case 0xB0: case 0xD0: case 0xF0: { //bcc bcs bne beq
+      static const uint8_t branchflag[4] = { FLAG_SIGN, FLAG_OVERFLOW, FLAG_CARRY, FLAG_ZERO };
+      uint16_t reladdr = (uint16_t)read6502(minpc + 1);
+      uint16_t next = minpc + 2, target;
+      __m256i clear, taken;
+      uint32_t takenbits;
+
+      if (reladdr & 0x80) reladdr |= 0xFF00;
+      target = next + reladdr;
+
+      clear = _mm256_cmpeq_epi8(_mm256_and_si256(nst, _mm256_set1_epi8((char)branchflag[opcode >> 6])), _mm256_setzero_si256());
+      taken = (opcode & 0x20) ? _mm256_andnot_si256(clear, mask) : _mm256_and_si256(clear, mask);
+      takenbits = (uint32_t)_mm256_movemask_epi8(taken);
+
+      st = _mm256_blendv_epi8(st, nst, mask);
+      _mm256_storeu_si256((__m256i *)(l->status + base), st);
+      setpc(l, base, bits, next);
+      if (takenbits) setpc(l, base, takenbits, target);
+      addticks(l, base, _mm256_and_si256(mask,
+            _mm256_blendv_epi8(_mm256_set1_epi8(2), _mm256_set1_epi8((next & 0xFF00) != (target & 0xFF00) ? 4 : 3), taken)), mask);
+      return 1;
+    }
+    default:
+      return 0;
+  }
+
+  _mm256_storeu_si256((__m256i *)(l->a + base), _mm256_blendv_epi8(a, na, mask));
+  _mm256_storeu_si256((__m256i *)(l->x + base), _mm256_blendv_epi8(x, nx, mask));
+  _mm256_storeu_si256((__m256i *)(l->y + base), _mm256_blendv_epi8(y, ny, mask));
+  _mm256_storeu_si256((__m256i *)(l->sp + base), _mm256_blendv_epi8(sp, nsp, mask));
+  _mm256_storeu_si256((__m256i *)(l->status + base), _mm256_blendv_epi8(st, nst, mask));
+  setpc(l, base, bits, minpc + len);
+  addticks(l, base, _mm256_and_si256(mask, _mm256_set1_epi8((char)ticks)), mask);
+  return 1;
+}
+#else
+static uint16_t groupminpc(const uint16_t *pc) {
+  uint16_t m = pc[0];
+  for (uint32_t i = 1; i < LANE_GROUP; i++) if (pc[i] < m) m = pc[i];
+  return m;
+}
+
+static uint32_t groupmask(const uint16_t *pc, uint16_t minpc) {
+  uint32_t bits = 0;
+  for (uint32_t i = 0; i < LANE_GROUP; i++) if (pc[i] == minpc) bits |= 1u << i;
+  return bits;
+}
+
+static int vectorop(CPU_Lanes *l, uint32_t g, uint16_t minpc, uint32_t bits) {
+  return 0;
+}
+#endif
+
+//picks the next lanes to issue: the lowest pc, unless a lane has waited too
+//long. Counts the wait of every live lane left out
+static uint32_t issuelanes(CPU_Lanes *l, uint32_t g, uint16_t *issuepc) {
+  uint32_t base = g * LANE_GROUP;
+  uint32_t live = livemask(l, g), bits, longest = 0;
+  uint16_t pc = l->oldest[g] < LANE_GROUP ? l->pc[base + l->oldest[g]] : groupminpc(l->pc + base);
+
+  bits = groupmask(l->pc + base, pc) & live;
+  l->oldest[g] = LANE_GROUP;
+  for (uint32_t m = live; m; m &= m - 1) {
+    uint32_t i = __builtin_ctz(m);
+    if (bits & (1u << i)) {
+      l->waiting[base + i] = 0;
+    } else if (++l->waiting[base + i] >= LANE_STARVE && l->waiting[base + i] > longest) {
+      longest = l->waiting[base + i];
+      l->oldest[g] = i;
+    }
+  }
+  *issuepc = pc;
+  return bits;
+}
+
+static void stepgroup(CPU_Lanes *l, uint32_t g) {
+  uint32_t base = g * LANE_GROUP;
+  uint16_t pc;
+  uint32_t bits = issuelanes(l, g, &pc);
+
+  l->issued[g]++;
+  for (uint32_t m = bits; m; m &= m - 1) l->ran[base + __builtin_ctz(m)]++;
+
+  if (!tracing && pc >= LANE_RAM && vectorop(l, g, pc, bits)) return;
+
+  for (uint32_t m = bits; m; m &= m - 1) {
+    uint32_t i = base + __builtin_ctz(m);
+    loadlane(l, i);
+    step6502();
+    storelane(l, i);
+  }
+}
+
+//issue one instruction in every lane group
+void steplanes(CPU_Lanes *l) {
+  for (uint32_t g = 0; g < l->groups; g++) stepgroup(l, g);
+}
+
+//fraction of its group's issued instructions that a lane took part in
+double laneoccupancy(CPU_Lanes *l, uint32_t lane) {
+  uint64_t issued = l->issued[lane / LANE_GROUP];
+  return issued ? (double)l->ran[lane] / (double)issued : 0.0;
+}
+
+//average number of active lanes per issued instruction, over all groups
+double lanesoccupancy(CPU_Lanes *l) {
+  uint64_t issued = 0, ran = 0;
+  for (uint32_t g = 0; g < l->groups; g++) issued += l->issued[g];
+  for (uint32_t i = 0; i < l->count; i++) ran += l->ran[i];
+  return issued ? (double)ran / (double)issued : 0.0;
+}
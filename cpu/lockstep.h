@@ -0,0 +1,8 @@
+//lockstep interpreter for many CPUs running the same ROM, see lockstep.c
+
+void initlanes(CPU_Lanes *l, uint32_t count);
+void freelanes(CPU_Lanes *l);
+void resetlanes(CPU_Lanes *l);
+void steplanes(CPU_Lanes *l);
+double laneoccupancy(CPU_Lanes *l, uint32_t lane);
+double lanesoccupancy(CPU_Lanes *l);
@@ -0,0 +1,164 @@
+/* Lockstep lanes against the scalar core.
+ *
+ * Runs LANES lanes of a small rom through steplanes() next to LANES
+ * CPU_States stepped one at a time with step6502(), each pair on its own
+ * ram with the lane index as input. After every issue, every lane that took
+ * part is stepped on its scalar twin, and the registers and cycle counts
+ * of all lanes must match; ram is compared every RAM_CHECK issues and at
+ * the end. A quarter of the lanes spin forever in a loop below the rest of
+ * the code, so the others only finish if starved lanes get issued.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cpu.h"
+#include "lockstep.h"
+
+#define LANES 70 //not a multiple of LANE_GROUP, so the padding is exercised
+#define ISSUES 3000000
+#define RAM_CHECK 4096
+
+extern void step6502();
+extern void reset6502();
+extern CPU_State cpu;
+
+//$00 holds the lane's input. Lanes with input % 4 == 0 spin at $0806;
+//the others run an input-dependent loop 32 times and park at $0916
+static const uint8_t program[] = {
+  [0x000] = 0xA5, 0x00,       //      lda $00
+  [0x002] = 0x29, 0x03,       //      and #3
+  [0x004] = 0xD0, 0x05,       //      bne work
+  [0x006] = 0xE6, 0x01,       //spin: inc $01
+  [0x008] = 0x4C, 0x06, 0x08, //      jmp spin
+  [0x00B] = 0x4C, 0x00, 0x09, //work: jmp $0900
+  [0x100] = 0xA6, 0x00,       //outer: ldx $00
+  [0x102] = 0xA9, 0x00,       //      lda #0
+  [0x104] = 0x18,             //      clc
+  [0x105] = 0x65, 0x00,       //loop: adc $00
+  [0x107] = 0x9D, 0x00, 0x02, //      sta $0200,x
+  [0x10A] = 0x2A,             //      rol a
+  [0x10B] = 0xCA,             //      dex
+  [0x10C] = 0xD0, 0xF7,       //      bne loop
+  [0x10E] = 0xE6, 0x02,       //      inc $02
+  [0x110] = 0xA5, 0x02,       //      lda $02
+  [0x112] = 0xC9, 0x20,       //      cmp #$20
+  [0x114] = 0xD0, 0xEA,       //      bne outer
+  [0x116] = 0x4C, 0x16, 0x09, //done: jmp done
+};
+
+static uint8_t rom[0x800];
+static uint8_t *ram;
+
+uint8_t read6502(uint16_t address) {
+  if (address < LANE_RAM) return ram[address];
+  if (address < 0x1000) return rom[address - 0x800];
+  if (address == 0xFFFD) return 0x08;
+  return 0;
+}
+
+uint8_t fetch6502(uint16_t address) {
+  return read6502(address);
+}
+
+void write6502(uint16_t address, uint8_t value) {
+  if (address < LANE_RAM) ram[address] = value;
+}
+
+void laneram(uint8_t *lane) {
+  ram = lane;
+}
+
+static CPU_State scalar[LANES];
+static uint8_t scalarram[LANES][LANE_RAM];
+
+static void stepscalar(uint32_t i) {
+  cpu = scalar[i];
+  laneram(scalarram[i]);
+  step6502();
+  scalar[i] = cpu;
+}
+
+static int same(CPU_Lanes *l, uint32_t i, uint64_t issue) {
+  CPU_State *s = &scalar[i];
+  if (l->pc[i] == s->pc && l->sp[i] == s->sp && l->a[i] == s->a && l->x[i] == s->x && l->y[i] == s->y &&
+      l->status[i] == s->status && l->instructions[i] == s->instructions &&
+      l->clockticks6502[i] == s->clockticks6502) return 1;
+  printf("FAIL: issue %llu lane %u: lane PC:%04X A:%02X X:%02X Y:%02X SP:%02X P:%02X %llu cycles, "
+      "scalar PC:%04X A:%02X X:%02X Y:%02X SP:%02X P:%02X %llu cycles\n",
+      (unsigned long long)issue, i, l->pc[i], l->a[i], l->x[i], l->y[i], l->sp[i], l->status[i],
+      (unsigned long long)l->clockticks6502[i], s->pc, s->a, s->x, s->y, s->sp, s->status,
+      (unsigned long long)s->clockticks6502);
+  return 0;
+}
+
+static int sameram(CPU_Lanes *l, uint64_t issue) {
+  for (uint32_t i = 0; i < LANES; i++) {
+    if (memcmp(l->ram + (size_t)i * LANE_RAM, scalarram[i], LANE_RAM)) {
+      printf("FAIL: issue %llu lane %u: ram differs from the scalar core\n", (unsigned long long)issue, i);
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static int run(uint8_t core, const char *name) {
+  CPU_Lanes l = {0};
+  uint32_t ran[LANES];
+  uint64_t issue;
+
+  initlanes(&l, LANES);
+  l.core = core;
+  memset(scalar, 0, sizeof(scalar));
+  memset(scalarram, 0, sizeof(scalarram));
+  for (uint32_t i = 0; i < LANES; i++) {
+    l.id[i] = scalar[i].id = i + 1;
+    scalar[i].core = core;
+    l.ram[(size_t)i * LANE_RAM] = scalarram[i][0] = (uint8_t)i;
+    cpu = scalar[i];
+    laneram(scalarram[i]);
+    reset6502();
+    scalar[i] = cpu;
+  }
+  resetlanes(&l);
+
+  for (issue = 1; issue <= ISSUES; issue++) {
+    uint32_t finished = 0;
+
+    for (uint32_t i = 0; i < LANES; i++) ran[i] = l.instructions[i];
+    steplanes(&l);
+    for (uint32_t i = 0; i < LANES; i++) {
+      if (l.instructions[i] != ran[i]) stepscalar(i);
+      if (!same(&l, i, issue)) return 1;
+      finished += (i & 3) == 0 || l.pc[i] == 0x0916;
+    }
+    if (!(issue % RAM_CHECK) && !sameram(&l, issue)) return 1;
+    if (finished == LANES) break;
+  }
+  if (!sameram(&l, issue)) return 1;
+  if (issue > ISSUES) {
+    printf("FAIL: %s: lanes above the spinning ones did not finish in %u issues\n", name, ISSUES);
+    return 1;
+  }
+  for (uint32_t i = 1; i < LANES; i += 4) {
+    if (l.ram[(size_t)i * LANE_RAM + 2] != 0x20) {
+      printf("FAIL: %s: lane %u finished with $02 = %02X\n", name, i, l.ram[(size_t)i * LANE_RAM + 2]);
+      return 1;
+    }
+  }
+  printf("%s: %u lanes match the scalar core over %llu issues, %.2f lanes per issue\n",
+      name, LANES, (unsigned long long)issue, lanesoccupancy(&l));
+  freelanes(&l);
+  return 0;
+}
+
+int main() {
+  memcpy(rom, program, sizeof(program));
+  if (run(CORE_NMOS, "nmos") || run(CORE_2A03, "2a03") || run(CORE_STRICT, "strict") || run(CORE_65C02, "65c02")) {
+    printf("FAIL\n");
+    return 1;
+  }
+  printf("PASS\n");
+  return 0;
+}
@@ -0,0 +1,120 @@
+/* Mailbox device connecting cpu1 and cpu2.
+ *
+ * Each cpu sees the same register block at MAILBOX_BASE (see mailbox.h),
+ * banked by cpu.id: DATA pushes into the queue towards the peer and pops
+ * from the queue coming from it. Writing DOORBELL ORs the value into the
+ * peer's doorbell bits, which raise its irq line if it enabled that in
+ * CTRL.
+ *
+ * Every queue has exactly one producer and one consumer, so they are
+ * lock-free single-producer/single-consumer rings and the two cpus may
+ * run on separate host threads. The irq line is level-triggered: the board
+ * polls mailboxirq() when it switches cpus, and the guest acknowledges by
+ * reading DOORBELL or draining DATA.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include "mailbox.h"
+
+#define MAILBOX_SIZE 256 //bytes per queue, power of two
+
+typedef struct {
+  _Alignas(64) atomic_uint head; //consumer position
+  _Alignas(64) atomic_uint tail; //producer position
+  uint8_t data[MAILBOX_SIZE];
+} Mailbox_Ring;
+
+typedef struct {
+  Mailbox_Ring rx; //written by the peer, read by this cpu
+  atomic_uchar doorbell; //rung by the peer
+  atomic_uchar status; //sticky overflow bit
+  uint8_t ctrl;
+} Mailbox_Port;
+
+static Mailbox_Port ports[2];
+
+static int ringpush(Mailbox_Ring *r, uint8_t value) {
+  unsigned tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+  unsigned head = atomic_load_explicit(&r->head, memory_order_acquire);
+  if (tail - head == MAILBOX_SIZE) return 0;
+
+  r->data[tail & (MAILBOX_SIZE - 1)] = value;
+  atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+  return 1;
+}
+
+static int ringpop(Mailbox_Ring *r, uint8_t *value) {
+  unsigned head = atomic_load_explicit(&r->head, memory_order_relaxed);
+  unsigned tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+  if (head == tail) return 0;
+
+  *value = r->data[head & (MAILBOX_SIZE - 1)];
+  atomic_store_explicit(&r->head, head + 1, memory_order_release);
+  return 1;
+}
+
+static unsigned ringcount(Mailbox_Ring *r) {
+  return atomic_load_explicit(&r->tail, memory_order_acquire) - atomic_load_explicit(&r->head, memory_order_relaxed);
+}
+
+//cpu ids are 1 and 2
+static Mailbox_Port *port(uint64_t id) {
+  return &ports[(id - 1) & 1];
+}
+
+static Mailbox_Port *peer(uint64_t id) {
+  return &ports[id & 1];
+}
+
+uint8_t mailboxread(uint64_t id, uint8_t reg) {
+  Mailbox_Port *p = port(id);
+  uint8_t value = 0;
+
+  switch (reg) {
+    case MAILBOX_DATA:
+      ringpop(&p->rx, &value);
+      return value;
+    case MAILBOX_STATUS:
+      value = atomic_exchange_explicit(&p->status, 0, memory_order_relaxed);
+      if (ringcount(&p->rx)) value |= MAILBOX_RXREADY;
+      if (ringcount(&peer(id)->rx) == MAILBOX_SIZE) value |= MAILBOX_TXFULL;
+      if (atomic_load_explicit(&p->doorbell, memory_order_relaxed)) value |= MAILBOX_RANG;
+      return value;
+    case MAILBOX_DOORBELL:
+      return atomic_exchange_explicit(&p->doorbell, 0, memory_order_acquire);
+    case MAILBOX_CTRL:
+      return p->ctrl;
+    case MAILBOX_COUNT: {
+      unsigned count = ringcount(&p->rx);
+      return count > 0xFF ? 0xFF : count;
+    }
+  }
+  return 0;
+}
+
+void mailboxwrite(uint64_t id, uint8_t reg, uint8_t value) {
+  Mailbox_Port *p = port(id);
+
+  switch (reg) {
+    case MAILBOX_DATA:
+      if (!ringpush(&peer(id)->rx, value)) atomic_fetch_or_explicit(&p->status, MAILBOX_OVERFLOW, memory_order_relaxed);
+      break;
+    case MAILBOX_DOORBELL:
+      atomic_fetch_or_explicit(&peer(id)->doorbell, value, memory_order_release);
+      break;
+    case MAILBOX_CTRL:
+      p->ctrl = value;
+      break;
+  }
+}
+
+//level of the mailbox irq line for cpu id
+uint8_t mailboxirq(uint64_t id) {
+  Mailbox_Port *p = port(id);
+
+  if ((p->ctrl & MAILBOX_IRQBELL) && atomic_load_explicit(&p->doorbell, memory_order_relaxed)) return 1;
+  if ((p->ctrl & MAILBOX_IRQRX) && ringcount(&p->rx)) return 1;
+  return 0;
+}
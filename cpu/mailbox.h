@@ -0,0 +1,23 @@
+//inter-cpu mailbox device, see mailbox.c
+
+#define MAILBOX_BASE 0x2100 //registers at $2100-$2104, banked per cpu
+
+#define MAILBOX_DATA     0x0 //read pops the inbound queue, write pushes the outbound one
+#define MAILBOX_STATUS   0x1
+#define MAILBOX_DOORBELL 0x2 //write rings the peer, read returns and clears our doorbell bits
+#define MAILBOX_CTRL     0x3
+#define MAILBOX_COUNT    0x4 //bytes waiting in the inbound queue
+
+//MAILBOX_STATUS bits
+#define MAILBOX_RXREADY  0x01
+#define MAILBOX_TXFULL   0x02
+#define MAILBOX_RANG     0x04
+#define MAILBOX_OVERFLOW 0x80 //a push was dropped, cleared when status is read
+
+//MAILBOX_CTRL bits
+#define MAILBOX_IRQBELL  0x01 //raise irq while doorbell bits are set
+#define MAILBOX_IRQRX    0x02 //raise irq while the inbound queue is not empty
+
+uint8_t mailboxread(uint64_t id, uint8_t reg);
+void mailboxwrite(uint64_t id, uint8_t reg, uint8_t value);
+uint8_t mailboxirq(uint64_t id);
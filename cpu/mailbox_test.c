@@ -0,0 +1,127 @@
+/* Mailbox stress test.
+ *
+ * cpu1 pushes BYTES bytes through MAILBOX_DATA on one host thread while
+ * cpu2 pops them on another, both through the register interface the
+ * board uses. The first pass honours MAILBOX_TXFULL, so nothing may be
+ * dropped or reordered and the overflow bit must never be set. The second
+ * pass pushes blindly; the producer notes every push the overflow bit says
+ * was dropped, and what the consumer saw must be exactly the rest, in
+ * order.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include "mailbox.h"
+
+#define BYTES 4000000
+
+static uint8_t *sent, *dropped, *received;
+static uint32_t count;
+static atomic_int done;
+static int blind, failed;
+
+static uint8_t pattern(uint32_t i) {
+  return (uint8_t)(i ^ (i >> 8) ^ (i >> 16));
+}
+
+static void *producer(void *arg) {
+  for (uint32_t i = 0; i < BYTES; i++) {
+    uint8_t status;
+
+    if (!blind) {
+      while (mailboxread(1, MAILBOX_STATUS) & MAILBOX_TXFULL) sched_yield();
+    } else if (!(i % 300)) sched_yield(); //let a consumer sharing the core drain some
+    sent[i] = pattern(i);
+    mailboxwrite(1, MAILBOX_DATA, sent[i]);
+    status = mailboxread(1, MAILBOX_STATUS);
+    dropped[i] = (status & MAILBOX_OVERFLOW) != 0;
+    if (dropped[i] && !blind) {
+      printf("FAIL: push %u overflowed with TXFULL clear\n", i);
+      failed = 1;
+    }
+  }
+  atomic_store(&done, 1);
+  return NULL;
+}
+
+static void *consumer(void *arg) {
+  while (1) {
+    int finished = atomic_load(&done);
+    uint8_t waiting = mailboxread(2, MAILBOX_COUNT);
+
+    if (!waiting) {
+      if (finished && !mailboxread(2, MAILBOX_COUNT)) break;
+      sched_yield();
+      continue;
+    }
+    while (waiting--) {
+      if (!(mailboxread(2, MAILBOX_STATUS) & MAILBOX_RXREADY)) {
+        printf("FAIL: COUNT said bytes were waiting but RXREADY is clear\n");
+        failed = 1;
+        return NULL;
+      }
+      if (count == BYTES) {
+        printf("FAIL: more bytes received than sent\n");
+        failed = 1;
+        return NULL;
+      }
+      received[count++] = mailboxread(2, MAILBOX_DATA);
+    }
+  }
+  return NULL;
+}
+
+static int pass(int drop) {
+  pthread_t p, c;
+  uint32_t n = 0, lost = 0;
+
+  blind = drop;
+  count = 0;
+  failed = 0;
+  atomic_store(&done, 0);
+  pthread_create(&c, NULL, consumer, NULL);
+  pthread_create(&p, NULL, producer, NULL);
+  pthread_join(p, NULL);
+  pthread_join(c, NULL);
+  if (failed) return 1;
+
+  for (uint32_t i = 0; i < BYTES; i++) {
+    if (dropped[i]) {
+      lost++;
+      continue;
+    }
+    if (n == count || received[n] != sent[i]) {
+      printf("FAIL: byte %u (received %u) is %02X, sent %02X\n", i, n, n < count ? received[n] : 0, sent[i]);
+      return 1;
+    }
+    n++;
+  }
+  if (n != count) {
+    printf("FAIL: %u bytes received, %u expected\n", count, n);
+    return 1;
+  }
+  if (!drop && lost) {
+    printf("FAIL: %u bytes dropped with flow control\n", lost);
+    return 1;
+  }
+  printf("%s: %u bytes pushed, %u received in order, %u dropped and flagged\n",
+      drop ? "blind" : "flow controlled", BYTES, count, lost);
+  return 0;
+}
+
+int main() {
+  sent = malloc(BYTES);
+  dropped = malloc(BYTES);
+  received = malloc(BYTES);
+  if (pass(0) || pass(1)) {
+    printf("FAIL\n");
+    return 1;
+  }
+  printf("PASS\n");
+  return 0;
+}
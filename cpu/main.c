@@ -1,15 +1,35 @@
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
+#include <time.h>
 #include <SDL2/SDL.h>
 #include "cpu.h"
+#include "trace.h"
+#include "scheduler.h"
+#include "mailbox.h"
+#include "telemetry.h"
+#include "input.h"
+#include "audio.h"
+#include "clone.h"
+#include "mathunit.h"
+#include "debug.h"
+#include "state.h"
+#include "lockstep.h"
 
-extern void step6502();
+extern void run6502(uint64_t deadline);
 extern void reset6502();
+extern void irq6502();
+extern int corebyname(const char *name);
+extern int coreforrom(const uint8_t *rom, uint16_t base, uint32_t size, const uint16_t *entries, int count);
 extern CPU_State cpu;
 
 uint8_t ram[0x800];
 uint8_t rom[0x800];
 uint64_t pixel = 0;
+uint32_t *framebuffer;
+uint64_t boardclock = 0;
+
+static CPU_State cpu1, cpu2;
 
 SDL_Surface *draw_surface;
 SDL_Surface *screen_surface;
@@ -18,77 +38,551 @@ SDL_Window *window;
 #define SCREEN_WIDTH 256
 #define SCREEN_HEIGHT 192
 
-uint8_t read6502(uint16_t address) {
-  if (address < 0x800) return ram[address];
-  if (address < 0x1000) return rom[address-0x800];
+#define PPU_DOTS (320*240) //one dot per clock, see ppu/ppu.v
+
+//memory map: a pointer to each 256-byte page that plain ram or rom backs,
+//NULL for device pages and for pages the debugger traps, which take the
+//slow path below. Untrapped code and data never look at the traps.
+static uint8_t *readmap[256], *writemap[256], *execmap[256];
+
+//the ram the map points at: the board's, or a lockstep lane's
+static uint8_t *ramview = ram;
+
+static uint8_t *pagememory(uint32_t page) {
+  if (page < 0x08) return ramview + page * 0x100;
+  if (page < 0x10) return rom + (page - 0x08) * 0x100;
+  return NULL;
+}
+
+static void mappage(uint32_t page) {
+  uint8_t *p = pagememory(page);
+  readmap[page] = traps[page] & TRAP_READ ? NULL : p;
+  execmap[page] = traps[page] & TRAP_EXEC ? NULL : p;
+  writemap[page] = page >= 0x08 || traps[page] & (TRAP_WRITE | TRAP_LOG) ? NULL : p;
+}
+
+//rebuilds the map, called again whenever traps change
+void mapmemory() {
+  for (uint32_t page = 0; page < 256; page++) mappage(page);
+}
+
+//points ram at a lockstep lane's LANE_RAM bytes, see lockstep.c
+void laneram(uint8_t *lane) {
+  ramview = lane;
+  for (uint32_t page = 0; page < LANE_RAM >> 8; page++) mappage(page);
+}
+
+//ram and rom contents without side effects, for the debugger
+uint8_t peek6502(uint16_t address) {
+  uint8_t *p = pagememory(address >> 8);
+  return p ? p[address & 0xFF] : 0;
+}
+
+static uint8_t readslow(uint16_t address) {
+  if ((address & 0xFFF8) == MAILBOX_BASE) return mailboxread(cpu.id, address & 0x7);
+  if ((address & 0xFFFC) == INPUT_BASE) return inputread(address & 0x3);
+  if ((address & 0xFFF8) == AUDIO_BASE) return audioread(address & 0x7);
+  if ((address & 0xFFF0) == MATH_BASE) return mathread(cpu.id, address & 0xF, cpu.clockticks6502);
   if (address == 0xFFFC) return 0x00;
   if (address == 0xFFFD) return 0x08;
-  return 0;
+  if (address >= 0xFFFA) return rom[address - 0xF800]; //nmi and irq vectors are the rom's last bytes
+  return peek6502(address);
+}
+
+uint8_t read6502(uint16_t address) {
+  uint8_t *page = readmap[address >> 8];
+  if (page) return page[address & 0xFF];
+  if (traps[address >> 8] & TRAP_READ) debugread(address);
+  return readslow(address);
+}
+
+uint8_t fetch6502(uint16_t address) {
+  uint8_t *page = execmap[address >> 8];
+  if (page) return page[address & 0xFF];
+  if (traps[address >> 8] & TRAP_EXEC) debugfetch(address);
+  return readslow(address);
 }
 
 void write6502(uint16_t address, uint8_t value) {
-  if (address < 0x800) ram[address] = value;
+  uint8_t *page = writemap[address >> 8];
+  if (page) {
+    page[address & 0xFF] = value;
+    return;
+  }
+  if (traps[address >> 8] & (TRAP_WRITE | TRAP_LOG)) debugwrite(address, value);
+
+  if (address < 0x800) ramview[address] = value;
+  if ((address & 0xFFF8) == MAILBOX_BASE) mailboxwrite(cpu.id, address & 0x7, value);
+  if ((address & 0xFFF8) == AUDIO_BASE) audiowrite(address & 0x7, value, cpu.clockticks6502);
+  if ((address & 0xFFF0) == MATH_BASE) mathwrite(cpu.id, address & 0xF, value, cpu.clockticks6502);
   if (address == 0x2000) {
-    uint32_t *pixels = (uint32_t *)draw_surface->pixels;
-    pixels[pixel++] = value | (value << 8) | (value << 16);
+    framebuffer[pixel++] = value | (value << 8) | (value << 16);
     if (pixel >= SCREEN_WIDTH*SCREEN_HEIGHT) {
       pixel = 0;
-      printf("%d\n", cpu.clockticks6502);
-
-      SDL_BlitScaled(draw_surface, NULL, screen_surface, NULL);
-      SDL_UpdateWindowSurface(window);
     }
   }
 }
 
 #define ZOOM 2
 
-int main() {
-  FILE *vrom = fopen("vrom", "rb");
-  fread(rom, 1, sizeof(rom), vrom);
-  fclose(vrom);
+//switch cpu in, taking the mailbox irq if it is raised and not masked.
+//A masked irq still ends a wai
+static void resume(CPU_State *c) {
+  cpu = *c;
+  if (mailboxirq(cpu.id) && (!(cpu.status & FLAG_INTERRUPT) || cpu.halt == HALT_WAI)) irq6502();
+}
+
+#define SLICE 64 //cycles each cpu runs before the other one gets the bus
+#define POLL_CYCLES 10000 //cycles between host event polls
+#define INPUT_CYCLES 1000 //default cycles between input queue drains
+#define STATS_PERIOD 500 //ms between rewrites of the --stats file
+#define AUDIO_RATE 48000
 
-  if (SDL_Init(SDL_INIT_VIDEO) < 0) {
-    printf("SDL could not initialize! SDL_Error: %s\n", SDL_GetError());
-    exit(1);
+//pacing: every cyclesperframe cycles frameevent() presents the framebuffer
+//and, unless unpaced, sleeps until that frame is due in host time
+uint64_t cpuhz = PPU_DOTS * 60;
+uint64_t fps = 60;
+uint8_t unpaced = 0;
+uint8_t headless = 0;
+uint64_t inputcycles = INPUT_CYCLES;
+
+static uint64_t cyclesperframe, framens;
+static uint64_t pacestart, pacecycle, lastframe, frames, skipped;
+
+#define MAX_LAG 4 //frames behind before the pacing schedule is rebased
+#define MAX_SKIP 8 //consecutive renders that may be skipped while behind
+
+static void present() {
+  uint64_t start = telemetrynow();
+  if (!headless) {
+    SDL_BlitScaled(draw_surface, NULL, screen_surface, NULL);
+    SDL_UpdateWindowSurface(window);
   }
-  window = SDL_CreateWindow("video", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, ZOOM*SCREEN_WIDTH, ZOOM*SCREEN_HEIGHT, SDL_WINDOW_SHOWN /*| SDL_WINDOW_FULLSCREEN*/);
-  if (window == NULL) {
-    printf("Window could not be created! SDL_Error: %s\n", SDL_GetError());
-    exit(1);
+  uint64_t now = telemetrynow();
+  telemetrypresent(now - start);
+  inputpresented(now);
+}
+
+static void frameevent(void *ctx, uint64_t when) {
+  uint64_t now = telemetrynow();
+  uint64_t due = pacestart + ++frames * framens;
+
+  schedule(when + cyclesperframe, frameevent, NULL);
+  audioframe(when);
+
+  if (unpaced) {
+    present();
+  } else if (now > due + framens && skipped < MAX_SKIP) {
+    //behind by more than a frame: keep emulating, skip the render
+    telemetrydropped();
+    skipped++;
+    if (now > due + MAX_LAG * framens) {
+      pacestart = now - frames * framens;
+    }
+  } else {
+    present();
+    skipped = 0;
+    if (telemetrynow() < due) {
+      struct timespec t = { due / 1000000000ull, due % 1000000000ull };
+      clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL);
+    }
+    telemetryjitter((int64_t)(telemetrynow() - due));
   }
 
-  if (!window) exit(1);
+  now = telemetrynow();
+  telemetryframe(now - lastframe);
+  lastframe = now;
+}
+
+void finish() {
+  audiostop();
+  telemetrystop();
+  tracestop();
+  exit(0);
+}
+
+//clones: at clonecycles the machine forks into clones copies that each run
+//on to --cycles, optionally fed their own input script
+uint32_t clones = 0, cloneindex = 0;
+uint64_t clonecycles = 0;
+char *cloneinput = NULL;
+
+//a digest of ram tells the outcomes of clones and lanes apart
+static uint64_t ramdigest(const uint8_t *r) {
+  uint64_t h = 0xCBF29CE484222325ull;
+  for (uint32_t i = 0; i < LANE_RAM; i++) h = (h ^ r[i]) * 0x100000001B3ull;
+  return h;
+}
+
+static void stopevent(void *ctx, uint64_t when) {
+  if (cloneindex) printf("clone %u: ram %016llX, ", cloneindex, (unsigned long long)ramdigest(ram));
+  printf("%llu cycles\n", (unsigned long long)when);
+  audiosync(when);
+  finish();
+}
+
+//emulated cycle the pacing schedule assigns to host time ns
+static uint64_t hostcycle(uint64_t ns) {
+  if (unpaced || ns < pacestart) return boardclock;
+  return pacecycle + (uint64_t)((double)(ns - pacestart) * cyclesperframe / framens);
+}
+
+static uint8_t padbutton(int key) {
+  switch (key) {
+    case SDLK_UP: return INPUT_UP;
+    case SDLK_DOWN: return INPUT_DOWN;
+    case SDLK_LEFT: return INPUT_LEFT;
+    case SDLK_RIGHT: return INPUT_RIGHT;
+    case SDLK_z: return INPUT_A;
+    case SDLK_x: return INPUT_B;
+    case SDLK_RSHIFT: return INPUT_SELECT;
+    case SDLK_RETURN: return INPUT_START;
+  }
+  return 0;
+}
 
-  screen_surface = SDL_GetWindowSurface(window);
-  draw_surface = SDL_CreateRGBSurface(0, SCREEN_WIDTH, SCREEN_HEIGHT,
-      screen_surface->format->BitsPerPixel,
-      screen_surface->format->Rmask, screen_surface->format->Gmask,
-      screen_surface->format->Bmask, screen_surface->format->Amask);
+static void pollevents(void *ctx, uint64_t when) {
   SDL_Event e;
+  while (SDL_PollEvent(&e)) {
+    if (e.type == SDL_QUIT) finish();
+    if (e.type == SDL_KEYDOWN || e.type == SDL_KEYUP) {
+      Input_Event in = {0};
+      in.hostns = telemetrynow();
+      in.cycle = hostcycle(in.hostns);
+      in.code = padbutton(e.key.keysym.sym);
+      if (in.code) {
+        in.type = e.type == SDL_KEYDOWN ? INPUT_PRESS : INPUT_RELEASE;
+        inputpost(&in);
+      }
+      if (e.type == SDL_KEYDOWN && !e.key.repeat && e.key.keysym.sym < 0x80) {
+        in.type = INPUT_TYPE;
+        in.code = e.key.keysym.sym;
+        inputpost(&in);
+      }
+    }
+  }
+  schedule(when + POLL_CYCLES, pollevents, NULL);
+}
 
-  CPU_State cpu1 = {0};
-  cpu1.id = 1;
-  CPU_State cpu2 = {0};
-  cpu2.id = 2;
-
-  cpu = cpu1;
-  reset6502();
-  cpu1 = cpu;
-  cpu = cpu2;
-  reset6502();
-  cpu2 = cpu;
-  while (1) {
-    while (SDL_PollEvent(&e)) {
-      if (e.type == SDL_QUIT) exit(0);
+static void cloneevent(void *ctx, uint64_t when) {
+  uint64_t ns = 0;
+
+  cloneindex = clonemachines(clones, &ns);
+  if (!cloneindex) {
+    printf("%u clones at cycle %llu in %llu us\n", clones, (unsigned long long)when, (unsigned long long)(ns / 1000));
+    uint32_t failed = clonewait();
+    if (failed) printf("%u clones failed\n", failed);
+    finish();
+  }
+
+  if (cloneinput) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s.%u", cloneinput, cloneindex);
+    if (inputscript(path)) {
+      printf("Could not open input script %s\n", path);
+      exit(1);
+    }
+  }
+}
+
+//--state= file written by --save-state-at= and read by --resume
+char *statepath = "vstate";
+
+//runs between slices, with both cpus switched out
+static void saveevent(void *ctx, uint64_t when) {
+  static Machine_State s;
+
+  s.boardclock = when;
+  s.pixel = pixel;
+  s.cpus[0] = cpu1;
+  s.cpus[1] = cpu2;
+  memcpy(s.ram, ram, sizeof(s.ram));
+  memcpy(s.rom, rom, sizeof(s.rom));
+  memcpy(s.framebuffer, framebuffer, sizeof(s.framebuffer));
+  if (statesave(statepath, &s)) {
+    printf("Could not save state to %s\n", statepath);
+    exit(1);
+  }
+  printf("state saved to %s at cycle %llu\n", statepath, (unsigned long long)when);
+}
+
+static void inputevent(void *ctx, uint64_t when) {
+  inputdrain(when);
+  schedule(when + inputcycles, inputevent, NULL);
+}
+
+static int digestorder(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+static int occupancyorder(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return x < y ? -1 : x > y;
+}
+
+//--lanes: runs count copies of the rom in lockstep until every lane reaches
+//cycles, each on its own ram with its lane index at input (if not -1),
+//then reports how many different rams they ended with
+static void runlanes(uint32_t count, uint8_t core, uint64_t cycles, int32_t input) {
+  CPU_Lanes l = {0};
+  uint64_t start, issues = 0, slowest = 0;
+  uint64_t *digests = calloc(count, sizeof(uint64_t));
+  double *occupancy = calloc(count, sizeof(double));
+  uint32_t distinct = 0, worst = 0;
+
+  initlanes(&l, count);
+  l.core = core;
+  for (uint32_t i = 0; i < count; i++) {
+    l.id[i] = i + 1;
+    if (input >= 0) l.ram[(size_t)i * LANE_RAM + input] = (uint8_t)i;
+  }
+  resetlanes(&l);
+
+  start = telemetrynow();
+  while (slowest < cycles) {
+    steplanes(&l);
+    issues++;
+    if (!(issues & 0xFF)) {
+      slowest = UINT64_MAX;
+      for (uint32_t i = 0; i < count; i++) {
+        if (l.clockticks6502[i] < slowest) slowest = l.clockticks6502[i];
+      }
     }
+  }
+
+  for (uint32_t i = 0; i < count; i++) digests[i] = ramdigest(l.ram + (size_t)i * LANE_RAM);
+  qsort(digests, count, sizeof(uint64_t), digestorder);
+  for (uint32_t i = 0; i < count; i++) distinct += !i || digests[i] != digests[i - 1];
+
+  printf("%u lanes to %llu cycles in %llu ms, %.2f lanes per issue, %u different rams\n",
+      count, (unsigned long long)cycles, (unsigned long long)((telemetrynow() - start) / 1000000),
+      lanesoccupancy(&l), distinct);
+
+  //how much divergence cost each lane: the share of its group's issues it ran
+  for (uint32_t i = 0; i < count; i++) {
+    occupancy[i] = laneoccupancy(&l, i);
+    if (occupancy[i] < occupancy[worst]) worst = i;
+  }
+  printf("lane occupancy: lowest %.3f (lane %u), ", occupancy[worst], worst);
+  qsort(occupancy, count, sizeof(double), occupancyorder);
+  printf("median %.3f, highest %.3f\n", occupancy[count / 2], occupancy[count - 1]);
+  laneram(ram);
+  freelanes(&l);
+  free(digests);
+  free(occupancy);
+}
+
+//where the rom can be entered: reset, and the nmi and irq vectors when they
+//point into it (a vector into ram can only reach code made at run time)
+static int romentries(uint16_t *entries) {
+  int count = 0;
+
+  entries[count++] = 0x0800;
+  for (uint32_t v = 0x7FA; v < 0x800; v += 4) { //$FFFA and $FFFE, see readslow()
+    uint16_t target = rom[v] | (rom[v + 1] << 8);
+    if (target >= 0x0800 && target < 0x1000) entries[count++] = target;
+  }
+  return count;
+}
+
+//first multiple of period at or after boardclock. Events keep the phase
+//they had when the state was saved, so the cpus' slices line up the same
+static uint64_t aligned(uint64_t period) {
+  return (boardclock + period - 1) / period * period;
+}
+
+int main(int argc, char **argv) {
+  int core1 = -1, core2 = -1;
+  uint64_t stopcycles = 0, savecycles = 0;
+  char *script = NULL, *wavpath = NULL, *rompath = "vrom";
+  Machine_State *resumed = NULL;
+  uint8_t resuming = 0;
+  uint32_t lanes = 0;
+  int32_t laneinput = -1;
+  uint16_t entries[3];
+  int entrycount;
+
+  mapmemory();
+  for (int i = 1; i < argc; i++) {
+    if (!strncmp(argv[i], "--trace=", 8)) {
+      if (tracestart(argv[i] + 8)) {
+        printf("Could not open trace file %s\n", argv[i] + 8);
+        exit(1);
+      }
+    }
+    if (!strncmp(argv[i], "--hz=", 5)) cpuhz = strtoull(argv[i] + 5, NULL, 0);
+    if (!strncmp(argv[i], "--fps=", 6)) fps = strtoull(argv[i] + 6, NULL, 0);
+    if (!strcmp(argv[i], "--unpaced")) unpaced = 1;
+    if (!strcmp(argv[i], "--headless")) headless = unpaced = 1;
+    if (!strncmp(argv[i], "--cycles=", 9)) stopcycles = strtoull(argv[i] + 9, NULL, 0);
+    if (!strncmp(argv[i], "--input=", 8)) script = argv[i] + 8;
+    if (!strncmp(argv[i], "--rom=", 6)) rompath = argv[i] + 6;
+    if (!strncmp(argv[i], "--break=", 8)) debugpoint(strtoul(argv[i] + 8, NULL, 16), TRAP_EXEC);
+    if (!strncmp(argv[i], "--watch=", 8)) debugpoint(strtoul(argv[i] + 8, NULL, 16), TRAP_READ | TRAP_WRITE);
+    if (!strncmp(argv[i], "--watch-read=", 13)) debugpoint(strtoul(argv[i] + 13, NULL, 16), TRAP_READ);
+    if (!strncmp(argv[i], "--watch-write=", 14)) debugpoint(strtoul(argv[i] + 14, NULL, 16), TRAP_WRITE);
+    if (!strncmp(argv[i], "--log-write=", 12)) debugpoint(strtoul(argv[i] + 12, NULL, 16), TRAP_LOG);
+    if (!strcmp(argv[i], "--debug")) debugstep();
+    if (!strncmp(argv[i], "--wav=", 6)) wavpath = argv[i] + 6;
+    if (!strncmp(argv[i], "--clones=", 9)) clones = strtoul(argv[i] + 9, NULL, 0);
+    if (!strncmp(argv[i], "--clone-at=", 11)) clonecycles = strtoull(argv[i] + 11, NULL, 0);
+    if (!strncmp(argv[i], "--clone-input=", 14)) cloneinput = argv[i] + 14;
+    if (!strncmp(argv[i], "--input-cycles=", 15)) inputcycles = strtoull(argv[i] + 15, NULL, 0);
+    if (!strncmp(argv[i], "--state=", 8)) statepath = argv[i] + 8;
+    if (!strncmp(argv[i], "--save-state-at=", 16)) savecycles = strtoull(argv[i] + 16, NULL, 0);
+    if (!strcmp(argv[i], "--resume")) resuming = 1;
+    if (!strncmp(argv[i], "--lanes=", 8)) lanes = strtoul(argv[i] + 8, NULL, 0);
+    if (!strncmp(argv[i], "--lane-input=", 13)) laneinput = strtoul(argv[i] + 13, NULL, 16) % LANE_RAM;
+    if (!strncmp(argv[i], "--core", 6)) {
+      //--core=<variant> sets both cpus, --core1= and --core2= one of them
+      char *name = strchr(argv[i], '=');
+      int variant = name ? corebyname(name + 1) : -1;
+      if (variant < 0) {
+        printf("Unknown core in %s, use nmos, 2a03, strict, 65c02 or recomp\n", argv[i]);
+        exit(1);
+      }
+      if (argv[i][6] != '2') core1 = variant;
+      if (argv[i][6] != '1') core2 = variant;
+    }
+    if (!strncmp(argv[i], "--stats=", 8)) {
+      if (telemetrystart(argv[i] + 8, STATS_PERIOD)) {
+        printf("Could not start telemetry\n");
+        exit(1);
+      }
+    }
+  }
+
+  //--resume takes the rom, like everything else, from the state file
+  if (resuming) {
+    resumed = stateload(statepath);
+    if (!resumed) {
+      printf("Could not resume from %s, missing, corrupt or from another build\n", statepath);
+      exit(1);
+    }
+    memcpy(rom, resumed->rom, sizeof(rom));
+    rompath = statepath;
+  } else {
+    FILE *vrom = fopen(rompath, "rb");
+    if (!vrom) {
+      printf("Could not open rom %s\n", rompath);
+      exit(1);
+    }
+    fread(rom, 1, sizeof(rom), vrom);
+    fclose(vrom);
+  }
+
+  if (headless) {
+    //a resumed framebuffer is used in place, its pages are private copies
+    framebuffer = resumed ? resumed->framebuffer : calloc(SCREEN_WIDTH*SCREEN_HEIGHT, sizeof(uint32_t));
+  } else {
+    if (SDL_Init(SDL_INIT_VIDEO) < 0) {
+      printf("SDL could not initialize! SDL_Error: %s\n", SDL_GetError());
+      exit(1);
+    }
+    window = SDL_CreateWindow("video", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, ZOOM*SCREEN_WIDTH, ZOOM*SCREEN_HEIGHT, SDL_WINDOW_SHOWN /*| SDL_WINDOW_FULLSCREEN*/);
+    if (window == NULL) {
+      printf("Window could not be created! SDL_Error: %s\n", SDL_GetError());
+      exit(1);
+    }
+
+    if (!window) exit(1);
+
+    screen_surface = SDL_GetWindowSurface(window);
+    draw_surface = SDL_CreateRGBSurface(0, SCREEN_WIDTH, SCREEN_HEIGHT,
+        screen_surface->format->BitsPerPixel,
+        screen_surface->format->Rmask, screen_surface->format->Gmask,
+        screen_surface->format->Bmask, screen_surface->format->Amask);
+    framebuffer = (uint32_t *)draw_surface->pixels;
+    if (resumed) memcpy(framebuffer, resumed->framebuffer, sizeof(resumed->framebuffer));
+  }
+
+  entrycount = romentries(entries);
+  if (resumed) {
+    memcpy(ram, resumed->ram, sizeof(ram));
+    pixel = resumed->pixel;
+    boardclock = resumed->boardclock;
+    cpu1 = resumed->cpus[0];
+    cpu2 = resumed->cpus[1];
+    if (core1 >= 0) cpu1.core = core1;
+    if (core2 >= 0) cpu2.core = core2;
+  } else {
+    cpu1.id = 1;
+    cpu1.core = core1 < 0 ? coreforrom(rom, 0x0800, sizeof(rom), entries, entrycount) : core1;
+    cpu2.id = 2;
+    cpu2.core = core2 < 0 ? coreforrom(rom, 0x0800, sizeof(rom), entries, entrycount) : core2;
 
     cpu = cpu1;
-    step6502();
+    reset6502();
     cpu1 = cpu;
     cpu = cpu2;
-    step6502();
+    reset6502();
+    cpu2 = cpu;
+  }
+
+  //recompiled code is only exact for the rom it was made from
+  if ((cpu1.core == CORE_RECOMP || cpu2.core == CORE_RECOMP) && coreforrom(rom, 0x0800, sizeof(rom), entries, entrycount) != CORE_RECOMP) {
+    printf("%s is not the rom this emulator was recompiled for\n", rompath);
+    exit(1);
+  }
+
+  if (lanes) {
+    if (!headless || !stopcycles) {
+      printf("--lanes needs --headless and --cycles\n");
+      exit(1);
+    }
+    runlanes(lanes, cpu1.core, stopcycles, laneinput);
+    finish();
+  }
+
+  if (!cpuhz || !fps || !inputcycles) {
+    printf("--hz, --fps and --input-cycles must be positive\n");
+    exit(1);
+  }
+  cyclesperframe = cpuhz / fps;
+  framens = 1000000000ull / fps;
+  pacestart = lastframe = telemetrynow();
+  pacecycle = boardclock;
+
+  if (clones) {
+    if (!headless || stopcycles <= clonecycles || clones > CLONE_MAX) {
+      printf("--clones needs --headless, --cycles past --clone-at and at most %u clones\n", CLONE_MAX);
+      exit(1);
+    }
+    schedule(clonecycles, cloneevent, NULL);
+  }
+
+  //cycle counts on the command line stay absolute across a resume
+  if (!headless) schedule(aligned(POLL_CYCLES), pollevents, NULL);
+  schedule(aligned(inputcycles), inputevent, NULL);
+  schedule(boardclock ? aligned(cyclesperframe) : cyclesperframe, frameevent, NULL);
+  if (savecycles) schedule(savecycles, saveevent, NULL); //before a stop at the same cycle
+  if (stopcycles) schedule(stopcycles, stopevent, NULL);
+  //headless runs only make sound when asked to write it to a file
+  if ((wavpath || !headless) && audiostart(wavpath, cpuhz, AUDIO_RATE, boardclock)) {
+    printf("Could not start audio%s%s\n", wavpath ? " file " : "", wavpath ? wavpath : "");
+    exit(1);
+  }
+  if (script && inputscript(script)) {
+    printf("Could not open input script %s\n", script);
+    exit(1);
+  }
+  while (1) {
+    uint64_t deadline = schednext();
+    //with both cpus parked by wai or stp only an event can change anything
+    if (!(cpu1.halt && cpu2.halt) && deadline > boardclock + SLICE) deadline = boardclock + SLICE;
+
+    resume(&cpu1);
+    run6502(deadline);
+    cpu1 = cpu;
+    resume(&cpu2);
+    run6502(deadline);
     cpu2 = cpu;
-    //getc(stdin);
+
+    telemetrycpu(cpu1.id, cpu1.instructions, cpu1.clockticks6502);
+    telemetrycpu(cpu2.id, cpu2.instructions, cpu2.clockticks6502);
+
+    boardclock = deadline;
+    schedrun(boardclock);
   }
 }
@@ -0,0 +1,157 @@
+; Benchmark for the multiply/divide unit (see mathunit.c).
+;
+; Forever: multiplies 256 pairs of 16-bit numbers with the classic
+; shift-and-add routine, writes the low byte of the sum of the products
+; to $2000, then does the same 256 products on the math unit and writes
+; its sum. The two bytes must match ($80); the cycles between the writes
+; give the speed-up. Run it with
+;
+;   ./main --headless --rom=mathbench --cycles=2000000 --log-write=2000
+;
+; which prints every write to $2000 with the cycles since the last one.
+; Measured that way, loop overhead included, a software pass takes 224806
+; cycles and a math unit pass 48931, 4.6 times fewer.
+
+MATH_A_LO   = $2400
+MATH_A_HI   = $2401
+MATH_B_LO   = $2402
+MATH_B_HI   = $2403
+MATH_CMD    = $2404
+MATH_STATUS = $2405
+MATH_R0     = $2408
+MATH_R1     = $2409
+MATH_R2     = $240A
+MATH_R3     = $240B
+MATH_MUL16  = $02
+
+num1 = $10 ; 16-bit operands
+num2 = $12
+prod = $14 ; 32-bit product
+sum  = $18 ; 32-bit sum of the products
+count = $1C
+owner = $1D ; set once a cpu has claimed the benchmark
+
+.segment "CODE"
+reset:
+  ldx #$FF
+  txs
+
+  ; both cpus run this rom on the same ram. The board runs cpu1's slice
+  ; first, so cpu1 claims the benchmark before cpu2 starts and cpu2 parks
+  lda owner
+  bne park
+  inc owner
+
+bench:
+  jsr clearsum
+software:
+  jsr operands
+  jsr mul16
+  jsr addsum
+  dec count
+  bne software
+  lda sum
+  sta $2000
+
+  jsr clearsum
+hardware:
+  jsr operands
+  jsr hwmul16
+  jsr addsum
+  dec count
+  bne hardware
+  lda sum
+  sta $2000
+  jmp bench
+
+park:
+  jmp park
+
+clearsum:
+  lda #0
+  sta sum
+  sta sum+1
+  sta sum+2
+  sta sum+3
+  sta count
+  rts
+
+; num1 = count * 257 + 1, num2 = count / 2 * 256 + (count ^ $A5)
+operands:
+  lda count
+  sta num1+1
+  sta num1
+  inc num1
+  eor #$A5
+  sta num2
+  lda count
+  lsr a
+  sta num2+1
+  rts
+
+addsum:
+  clc
+  lda sum
+  adc prod
+  sta sum
+  lda sum+1
+  adc prod+1
+  sta sum+1
+  lda sum+2
+  adc prod+2
+  sta sum+2
+  lda sum+3
+  adc prod+3
+  sta sum+3
+  rts
+
+; prod = num1 * num2, shift and add (destroys num1)
+mul16:
+  lda #0
+  sta prod+2
+  sta prod+3
+  ldx #16
+@shift:
+  lsr num1+1
+  ror num1
+  bcc @skip
+  lda prod+2
+  clc
+  adc num2
+  sta prod+2
+  lda prod+3
+  adc num2+1
+  sta prod+3
+@skip:
+  ror prod+3
+  ror prod+2
+  ror prod+1
+  ror prod
+  dex
+  bne @shift
+  rts
+
+; prod = num1 * num2 on the math unit
+hwmul16:
+  lda num1
+  sta MATH_A_LO
+  lda num1+1
+  sta MATH_A_HI
+  lda num2
+  sta MATH_B_LO
+  lda num2+1
+  sta MATH_B_HI
+  lda #MATH_MUL16
+  sta MATH_CMD
+@wait:
+  bit MATH_STATUS
+  bmi @wait
+  lda MATH_R0
+  sta prod
+  lda MATH_R1
+  sta prod+1
+  lda MATH_R2
+  sta prod+2
+  lda MATH_R3
+  sta prod+3
+  rts
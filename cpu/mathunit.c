@@ -0,0 +1,112 @@
+/* Multiply/divide unit.
+ *
+ * Each cpu has its own unit at MATH_BASE (see mathunit.h), banked by
+ * cpu.id like the mailbox. Writing MATH_CMD computes the result right away
+ * but only publishes it once the command's cycle cost has passed, which is
+ * about what an iterative hardware multiplier doing one or two bits a
+ * cycle would take: until then MATH_STATUS reads busy and the result
+ * registers still read the previous result. A new command issued while
+ * busy starts from the pending result, so back to back MACs accumulate.
+ *
+ * Nothing is stepped or scheduled, every access just compares the cpu's
+ * cycle count with the cycle the result is ready at.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include "mathunit.h"
+
+typedef struct {
+  uint16_t a, b;
+  uint32_t result, pending;
+  uint64_t ready; //cycle pending becomes visible
+  uint8_t status;
+} Math_Unit;
+
+static Math_Unit units[2];
+
+//cycle cost of each command, indexed by MATH_CMD
+static const uint8_t mathcycles[] = {
+  [MATH_MUL8] = 8,
+  [MATH_MUL16] = 16,
+  [MATH_DIV] = 16,
+  [MATH_MAC] = 16,
+  [MATH_CLEAR] = 1,
+};
+
+//cpu ids are 1 and 2
+static Math_Unit *unit(uint64_t id, uint64_t now) {
+  Math_Unit *u = &units[(id - 1) & 1];
+  if (now >= u->ready) u->result = u->pending;
+  return u;
+}
+
+uint8_t mathread(uint64_t id, uint8_t reg, uint64_t now) {
+  Math_Unit *u = unit(id, now);
+
+  switch (reg) {
+    case MATH_A_LO:
+      return u->a & 0xFF;
+    case MATH_A_HI:
+      return u->a >> 8;
+    case MATH_B_LO:
+      return u->b & 0xFF;
+    case MATH_B_HI:
+      return u->b >> 8;
+    case MATH_STATUS:
+      return u->status | (now < u->ready ? MATH_BUSY : 0);
+    case MATH_R0:
+    case MATH_R1:
+    case MATH_R2:
+    case MATH_R3:
+      return u->result >> ((reg - MATH_R0) * 8);
+  }
+  return 0;
+}
+
+void mathwrite(uint64_t id, uint8_t reg, uint8_t value, uint64_t now) {
+  Math_Unit *u = unit(id, now);
+
+  switch (reg) {
+    case MATH_A_LO:
+      u->a = (u->a & 0xFF00) | value;
+      break;
+    case MATH_A_HI:
+      u->a = (u->a & 0x00FF) | (value << 8);
+      break;
+    case MATH_B_LO:
+      u->b = (u->b & 0xFF00) | value;
+      break;
+    case MATH_B_HI:
+      u->b = (u->b & 0x00FF) | (value << 8);
+      break;
+    case MATH_CMD:
+      switch (value) {
+        case MATH_MUL8:
+          u->pending = (u->a & 0xFF) * (u->b & 0xFF);
+          break;
+        case MATH_MUL16:
+          u->pending = (uint32_t)u->a * u->b;
+          break;
+        case MATH_DIV:
+          u->status &= ~MATH_DIVZERO;
+          if (u->b & 0xFF) {
+            u->pending = (u->a / (u->b & 0xFF)) | ((u->a % (u->b & 0xFF)) << 16);
+          } else {
+            u->status |= MATH_DIVZERO;
+            u->pending = 0xFFFF | ((u->a & 0xFF) << 16);
+          }
+          break;
+        case MATH_MAC:
+          u->pending += (uint32_t)u->a * u->b;
+          break;
+        case MATH_CLEAR:
+          u->pending = 0;
+          break;
+        default:
+          return;
+      }
+      u->ready = now + mathcycles[value];
+      break;
+  }
+}
@@ -0,0 +1,28 @@
+//multiply/divide unit, see mathunit.c
+
+#define MATH_BASE 0x2400 //registers at $2400-$240B, banked per cpu
+
+#define MATH_A_LO   0x0 //operands
+#define MATH_A_HI   0x1
+#define MATH_B_LO   0x2
+#define MATH_B_HI   0x3
+#define MATH_CMD    0x4 //write starts a MATH_* command
+#define MATH_STATUS 0x5
+#define MATH_R0     0x8 //result, least significant byte first
+#define MATH_R1     0x9
+#define MATH_R2     0xA
+#define MATH_R3     0xB
+
+//MATH_CMD commands
+#define MATH_MUL8  0x01 //R0-R1 = A_LO * B_LO
+#define MATH_MUL16 0x02 //R0-R3 = A * B
+#define MATH_DIV   0x03 //R0-R1 = A / B_LO, R2 = A % B_LO
+#define MATH_MAC   0x04 //R0-R3 += A * B
+#define MATH_CLEAR 0x05 //R0-R3 = 0
+
+//MATH_STATUS bits
+#define MATH_DIVZERO 0x01 //last MATH_DIV had B_LO = 0, R0-R1 = $FFFF and R2 = A_LO
+#define MATH_BUSY    0x80 //the result registers still hold the previous result
+
+uint8_t mathread(uint64_t id, uint8_t reg, uint64_t now);
+void mathwrite(uint64_t id, uint8_t reg, uint8_t value, uint64_t now);
@@ -0,0 +1,240 @@
+/* Ahead-of-time recompiler for ROM images.
+ *
+ *   recomp [-c nmos|2a03|strict] [-e entry]... <rom> <out.c>
+ *
+ * Decodes the ROM with the core's own addrtable/optable/ticktable (read
+ * through disasm.c), follows every path reachable from the entry points
+ * (default $0800, the reset vector main.c supplies) and writes C with one
+ * function per basic block. Each instruction becomes the same addressing
+ * mode and instruction handlers instruction6502() would call, with the
+ * opcode, operands and cycle counts folded to constants, so the output is
+ * exact, just without fetch, decode and table dispatch.
+ *
+ * The output includes 6502.c as the "recomp" core variant with the chosen
+ * variant's defines and replaces its runto(): at every instruction
+ * boundary inside the ROM it enters the block starting there if there is
+ * one, and otherwise (RAM, indirect jump targets, anything the recovery
+ * missed, pages trapped by the debugger) it interprets one instruction.
+ * Blocks never cross a page and return at the deadline, so breakpoints
+ * and scheduled events fire at the same instruction as they would in the
+ * interpreter. Build it into the emulator with "make recompiled".
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpu.h"
+#include "disasm.h"
+
+//disasm.c brings in the core, which needs a bus; the tool never runs it
+CPU_State cpu;
+uint8_t read6502(uint16_t address) { return 0; }
+uint8_t fetch6502(uint16_t address) { return 0; }
+void write6502(uint16_t address, uint8_t value) {}
+
+#define ROM_BASE 0x800 //ROM region of video.cfg
+#define ROM_SIZE 0x800
+#define RECOMP_ENTRIES 16
+
+static uint8_t image[ROM_SIZE];
+static uint8_t decoded[ROM_SIZE]; //an instruction starts here
+static uint8_t leader[ROM_SIZE]; //a block starts here
+
+static int ismode(uint8_t op, const char *mode) {
+  return !strcmp(modename6502(op), mode);
+}
+
+static int isop(uint8_t op, const char *name) {
+  return !strcmp(opname6502(op), name);
+}
+
+static int inrom(uint32_t address) {
+  return address >= ROM_BASE && address < ROM_BASE + ROM_SIZE;
+}
+
+static uint8_t byte(uint32_t address) {
+  return image[address - ROM_BASE];
+}
+
+static uint16_t word(uint32_t address) {
+  return byte(address) | (byte(address + 1) << 8);
+}
+
+//the only relative mode instructions are the branches
+static int isbranch(uint8_t op) {
+  return ismode(op, "rel");
+}
+
+//instructions after which the next pc is not simply the following byte
+static int endsblock(uint8_t op) {
+  return isbranch(op) || isop(op, "jmp") || isop(op, "jsr") || isop(op, "rts") || isop(op, "rti") || isop(op, "brk");
+}
+
+static void recover(uint16_t *entries, int count) {
+  recover6502(image, ROM_BASE, ROM_SIZE, entries, count, decoded, leader);
+
+  //blocks never cross a page
+  for (uint32_t pc = ROM_BASE; pc < ROM_BASE + ROM_SIZE; pc++) {
+    uint32_t next = pc + length6502(byte(pc));
+    if (decoded[pc - ROM_BASE] && !endsblock(byte(pc)) && inrom(next) && (next & 0xFF00) != (pc & 0xFF00)) leader[next - ROM_BASE] = 1;
+  }
+}
+
+static void emitinstruction(FILE *f, uint32_t pc, int last) {
+  uint8_t op = byte(pc);
+  uint32_t len = length6502(op);
+  uint16_t next = (pc + len) & 0xFFFF;
+  const char *m = modename6502(op);
+  uint8_t bytes[3] = { op, len > 1 ? byte(pc + 1) : 0, len > 2 ? byte(pc + 2) : 0 };
+  char text[32];
+
+  disasm6502(pc, bytes, text, sizeof(text));
+  fprintf(f, "  //%04X:", pc);
+  for (uint32_t i = 0; i < 3; i++) {
+    if (i < len) fprintf(f, " %02X", bytes[i]);
+    else fprintf(f, "   ");
+  }
+  fprintf(f, "  %s\n", text);
+
+  fprintf(f, "  cpu.opcode = 0x%02X;\n", op);
+  fprintf(f, "  cpu.status |= FLAG_CONSTANT;\n");
+  fprintf(f, "  penaltyop = 0;\n");
+  fprintf(f, "  penaltyaddr = 0;\n");
+
+  if (ismode(op, "ind") || ismode(op, "indx") || ismode(op, "indy")) {
+    fprintf(f, "  cpu.pc = 0x%04X;\n", pc + 1);
+    fprintf(f, "  %s();\n", m);
+  } else {
+    fprintf(f, "  cpu.pc = 0x%04X;\n", next);
+    if (ismode(op, "imm")) fprintf(f, "  cpu.ea = 0x%04X;\n", pc + 1);
+    if (ismode(op, "zp")) fprintf(f, "  cpu.ea = 0x%02X;\n", bytes[1]);
+    if (ismode(op, "zpx")) fprintf(f, "  cpu.ea = (0x%02X + cpu.x) & 0xFF;\n", bytes[1]);
+    if (ismode(op, "zpy")) fprintf(f, "  cpu.ea = (0x%02X + cpu.y) & 0xFF;\n", bytes[1]);
+    if (ismode(op, "rel")) fprintf(f, "  cpu.reladdr = 0x%04X;\n", (uint16_t)(int8_t)bytes[1]);
+    if (ismode(op, "abso")) fprintf(f, "  cpu.ea = 0x%04X;\n", word(pc + 1));
+    if (ismode(op, "absx") || ismode(op, "absy")) {
+      fprintf(f, "  cpu.ea = 0x%04X + cpu.%c;\n", word(pc + 1), ismode(op, "absx") ? 'x' : 'y');
+      fprintf(f, "  if ((cpu.ea & 0xFF00) != 0x%04X) penaltyaddr = 1;\n", word(pc + 1) & 0xFF00);
+    }
+  }
+
+  fprintf(f, "  %s();\n", opname6502(op));
+  fprintf(f, "  cpu.clockticks6502 += %u;\n", ticks6502(op));
+  if (ismode(op, "absx") || ismode(op, "absy") || ismode(op, "indy")) fprintf(f, "  if (penaltyop && penaltyaddr) cpu.clockticks6502++;\n");
+  fprintf(f, "  cpu.instructions++;\n");
+  fprintf(f, "  if (tracing) tracerecord(&cpu, 0x%04X);\n", pc);
+  if (!last) fprintf(f, "  if (cpu.clockticks6502 >= deadline) return;\n\n");
+}
+
+static uint32_t emitblock(FILE *f, uint32_t start) {
+  uint32_t pc = start, count = 0;
+
+  fprintf(f, "static void block%04X(uint64_t deadline) {\n", start);
+  while (1) {
+    uint8_t op = byte(pc);
+    uint32_t next = pc + length6502(op);
+    int last = endsblock(op) || !inrom(next) || !decoded[next - ROM_BASE] || leader[next - ROM_BASE];
+
+    emitinstruction(f, pc, last);
+    count++;
+    if (last) break;
+    pc = next;
+  }
+  fprintf(f, "}\n\n");
+  return count;
+}
+
+//FNV-1a, so the emulator can tell whether its ROM is the one compiled here
+static uint64_t checksum(const uint8_t *data, uint32_t size) {
+  uint64_t h = 0xCBF29CE484222325ull;
+  for (uint32_t i = 0; i < size; i++) {
+    h ^= data[i];
+    h *= 0x100000001B3ull;
+  }
+  return h;
+}
+
+int main(int argc, char **argv) {
+  uint16_t entries[RECOMP_ENTRIES];
+  int count = 0, i = 1;
+  const char *variant = "nmos";
+  uint32_t blocks = 0, instructions = 0;
+
+  for (; i < argc - 2; i++) {
+    if (!strcmp(argv[i], "-c") && i + 1 < argc - 2) variant = argv[++i];
+    else if (!strcmp(argv[i], "-e") && i + 1 < argc - 2 && count < RECOMP_ENTRIES) entries[count++] = strtoul(argv[++i], NULL, 0);
+    else break;
+  }
+  if (argc - i != 2 || (strcmp(variant, "nmos") && strcmp(variant, "2a03") && strcmp(variant, "strict"))) {
+    printf("usage: %s [-c nmos|2a03|strict] [-e entry]... <rom> <out.c>\n", argv[0]);
+    return 2;
+  }
+  if (!count) entries[count++] = ROM_BASE;
+
+  FILE *in = fopen(argv[i], "rb");
+  if (!in) {
+    printf("could not open rom %s\n", argv[i]);
+    return 2;
+  }
+  //short images are zero padded, like the emulator's rom array
+  if (!fread(image, 1, sizeof(image), in)) {
+    printf("empty rom %s\n", argv[i]);
+    return 2;
+  }
+  fclose(in);
+
+  recover(entries, count);
+
+  FILE *f = fopen(argv[i + 1], "w");
+  if (!f) {
+    printf("could not write %s\n", argv[i + 1]);
+    return 2;
+  }
+
+  fprintf(f, "//%s recompiled by recomp.c for the %s core, do not edit\n\n", argv[i], variant);
+  fprintf(f, "#define CORE recomp\n");
+  if (strcmp(variant, "strict")) fprintf(f, "#define UNDOCUMENTED\n");
+  if (!strcmp(variant, "2a03")) fprintf(f, "#define NES_CPU\n");
+  fprintf(f, "#define BLOCKS\n");
+  fprintf(f, "#include \"6502.c\"\n");
+  fprintf(f, "#include \"debug.h\"\n\n");
+  fprintf(f, "#define ROM_BASE 0x%04X\n", ROM_BASE);
+  fprintf(f, "#define ROM_SIZE 0x%04X\n\n", ROM_SIZE);
+
+  for (uint32_t pc = ROM_BASE; pc < ROM_BASE + ROM_SIZE; pc++) {
+    if (!leader[pc - ROM_BASE] || !decoded[pc - ROM_BASE]) continue;
+    instructions += emitblock(f, pc);
+    blocks++;
+  }
+
+  fprintf(f, "static void (*const blocks[ROM_SIZE])(uint64_t deadline) = {\n");
+  for (uint32_t pc = ROM_BASE; pc < ROM_BASE + ROM_SIZE; pc++) {
+    if (leader[pc - ROM_BASE] && decoded[pc - ROM_BASE]) fprintf(f, "  [0x%03X] = block%04X,\n", pc - ROM_BASE, pc);
+  }
+  fprintf(f, "};\n\n");
+
+  fprintf(f, "static void runto(uint64_t deadline) {\n");
+  fprintf(f, "  while (cpu.clockticks6502 < deadline) {\n");
+  fprintf(f, "    uint16_t offset = cpu.pc - ROM_BASE;\n");
+  fprintf(f, "    if (offset < ROM_SIZE && blocks[offset] && !(traps[cpu.pc >> 8] & TRAP_EXEC)) blocks[offset](deadline);\n");
+  fprintf(f, "    else instruction6502();\n");
+  fprintf(f, "  }\n");
+  fprintf(f, "}\n\n");
+
+  fprintf(f, "//1 when rom is the image this file was compiled from\n");
+  fprintf(f, "int recompiledrom(const uint8_t *rom, uint32_t size) {\n");
+  fprintf(f, "  uint64_t h = 0xCBF29CE484222325ull;\n");
+  fprintf(f, "  if (size != ROM_SIZE) return 0;\n");
+  fprintf(f, "  for (uint32_t i = 0; i < size; i++) {\n");
+  fprintf(f, "    h ^= rom[i];\n");
+  fprintf(f, "    h *= 0x100000001B3ull;\n");
+  fprintf(f, "  }\n");
+  fprintf(f, "  return h == 0x%016llXull;\n", (unsigned long long)checksum(image, ROM_SIZE));
+  fprintf(f, "}\n");
+  fclose(f);
+
+  printf("%u blocks, %u instructions\n", blocks, instructions);
+  return 0;
+}
@@ -0,0 +1,97 @@
+/* Cycle-keyed event scheduler.
+ *
+ * Devices register callbacks at absolute cycle times with schedule().
+ * The CPU loop asks schednext() for the earliest deadline, runs straight
+ * to it, then calls schedrun() to fire everything that is due. Events are
+ * kept in a binary min-heap ordered by deadline, ties fire in the order
+ * they were scheduled.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "scheduler.h"
+
+typedef struct {
+  uint64_t when;
+  uint32_t id;
+  Sched_Callback callback;
+  void *ctx;
+} Sched_Event;
+
+static Sched_Event *heap;
+static uint32_t heapsize, heapcap;
+static uint32_t nextid = 1;
+
+static int before(Sched_Event *a, Sched_Event *b) {
+  if (a->when != b->when) return a->when < b->when;
+  return (int32_t)(a->id - b->id) < 0;
+}
+
+static void siftup(uint32_t i) {
+  Sched_Event e = heap[i];
+  while (i) {
+    uint32_t parent = (i - 1) / 2;
+    if (!before(&e, &heap[parent])) break;
+    heap[i] = heap[parent];
+    i = parent;
+  }
+  heap[i] = e;
+}
+
+static void siftdown(uint32_t i) {
+  Sched_Event e = heap[i];
+  while (1) {
+    uint32_t child = 2 * i + 1;
+    if (child >= heapsize) break;
+    if (child + 1 < heapsize && before(&heap[child + 1], &heap[child])) child++;
+    if (!before(&heap[child], &e)) break;
+    heap[i] = heap[child];
+    i = child;
+  }
+  heap[i] = e;
+}
+
+//calls callback(ctx, when) once the clock reaches when, returns an id for unschedule()
+uint32_t schedule(uint64_t when, Sched_Callback callback, void *ctx) {
+  uint32_t id = nextid++;
+
+  if (heapsize == heapcap) {
+    heapcap = heapcap ? heapcap * 2 : 16;
+    heap = realloc(heap, heapcap * sizeof(Sched_Event));
+  }
+
+  heap[heapsize].when = when;
+  heap[heapsize].id = id;
+  heap[heapsize].callback = callback;
+  heap[heapsize].ctx = ctx;
+  siftup(heapsize++);
+  return id;
+}
+
+void unschedule(uint32_t id) {
+  for (uint32_t i = 0; i < heapsize; i++) {
+    if (heap[i].id != id) continue;
+
+    heap[i] = heap[--heapsize];
+    if (i < heapsize) {
+      siftdown(i);
+      siftup(i);
+    }
+    return;
+  }
+}
+
+uint64_t schednext() {
+  return heapsize ? heap[0].when : SCHED_NEVER;
+}
+
+//fires every event due at or before now, including ones scheduled by the callbacks
+void schedrun(uint64_t now) {
+  while (heapsize && heap[0].when <= now) {
+    Sched_Event e = heap[0];
+    heap[0] = heap[--heapsize];
+    if (heapsize) siftdown(0);
+    e.callback(e.ctx, e.when);
+  }
+}
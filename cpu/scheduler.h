@@ -0,0 +1,10 @@
+//cycle-keyed event scheduler, see scheduler.c
+
+#define SCHED_NEVER UINT64_MAX
+
+typedef void (*Sched_Callback)(void *ctx, uint64_t when);
+
+uint32_t schedule(uint64_t when, Sched_Callback callback, void *ctx);
+void unschedule(uint32_t id);
+uint64_t schednext();
+void schedrun(uint64_t now);
@@ -0,0 +1,83 @@
+/* Machine state files.
+ *
+ * A state file is a Machine_State (see state.h) written out as is: a
+ * header, both CPU_States, ram, rom, the framebuffer and the pixel cursor
+ * at fixed offsets. Resuming maps the file copy-on-write and checks the
+ * header, nothing is parsed, so a job can start from a booted machine in
+ * the time it takes to map a few pages. Writes to a resumed machine stay
+ * private, the file is never changed.
+ *
+ * The header rejects files from another layout: the magic, STATE_VERSION
+ * (bump it when fields change) and sizeof(Machine_State), which moves with
+ * CPU_State. Files are in host byte order, for the machine that wrote them.
+ *
+ * Only the board itself is saved. The mailbox, math unit, audio and input
+ * devices come back in their power-on state and main.c schedules its
+ * events again, so save at a point where no device work is in flight,
+ * such as right after the guest's initialisation.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "cpu.h"
+#include "state.h"
+
+//fills in the header and writes s to path. The file is written under a
+//temporary name and renamed, so a resuming job never maps half of it
+int statesave(const char *path, Machine_State *s) {
+  char temp[512];
+  FILE *f;
+
+  memcpy(s->magic, STATE_MAGIC, sizeof(s->magic));
+  s->version = STATE_VERSION;
+  s->size = sizeof(Machine_State);
+
+  snprintf(temp, sizeof(temp), "%s.tmp", path);
+  f = fopen(temp, "wb");
+  if (!f) return -1;
+  if (fwrite(s, sizeof(Machine_State), 1, f) != 1) {
+    fclose(f);
+    remove(temp);
+    return -1;
+  }
+  if (fclose(f) || rename(temp, path)) {
+    remove(temp);
+    return -1;
+  }
+  return 0;
+}
+
+//maps the state file at path, or returns NULL if it is missing, was
+//written by a build with another layout or holds an out of range index
+Machine_State *stateload(const char *path) {
+  Machine_State *s;
+  struct stat st;
+  int fd = open(path, O_RDONLY);
+
+  if (fd < 0) return NULL;
+  if (fstat(fd, &st) || st.st_size != sizeof(Machine_State)) {
+    close(fd);
+    return NULL;
+  }
+  s = mmap(NULL, sizeof(Machine_State), PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (s == MAP_FAILED) return NULL;
+
+  if (memcmp(s->magic, STATE_MAGIC, sizeof(s->magic)) || s->version != STATE_VERSION ||
+      s->size != sizeof(Machine_State) || s->pixel >= STATE_PIXELS) {
+    munmap(s, sizeof(Machine_State));
+    return NULL;
+  }
+  for (uint32_t i = 0; i < STATE_CPUS; i++) {
+    if (s->cpus[i].core >= CORE_VARIANTS) {
+      munmap(s, sizeof(Machine_State));
+      return NULL;
+    }
+  }
+  return s;
+}
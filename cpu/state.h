@@ -0,0 +1,26 @@
+//machine state files, see state.c
+
+#define STATE_MAGIC   "VSTATE\r\n"
+#define STATE_VERSION 1
+
+#define STATE_CPUS   2
+#define STATE_RAM    0x800
+#define STATE_ROM    0x800
+#define STATE_PIXELS (256*192) //SCREEN_WIDTH*SCREEN_HEIGHT in main.c
+
+//the file is this struct, in host byte order with no padding between the
+//arrays, so a mapped file is used in place
+typedef struct {
+  char magic[8]; //STATE_MAGIC
+  uint32_t version; //STATE_VERSION
+  uint32_t size; //sizeof(Machine_State), catches CPU_State changes
+  uint64_t boardclock;
+  uint64_t pixel;
+  CPU_State cpus[STATE_CPUS];
+  uint8_t ram[STATE_RAM];
+  uint8_t rom[STATE_ROM];
+  uint32_t framebuffer[STATE_PIXELS];
+} Machine_State;
+
+int statesave(const char *path, Machine_State *s);
+Machine_State *stateload(const char *path);
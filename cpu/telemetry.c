@@ -0,0 +1,193 @@
+/* Runtime telemetry.
+ *
+ * The emulation thread only does relaxed atomic stores and increments
+ * here. When started with a stats file, a background thread rewrites that
+ * file every period (to a temporary name, then rename(), so readers never
+ * see a partial file) as "name value" lines:
+ *
+ *   cpu<id>_instructions, cpu<id>_cycles, cpu<id>_mhz
+ *   frames, dropped_frames
+ *   frame_ns_count/sum/p50/p99 and frame_ns_lt_<bound> buckets
+ *   present_ns_... likewise
+ *   jitter_ns_..., how late paced frames woke up (early wakeups count as 0)
+ *   input_ns_..., host input arrival to the first frame presented after it
+ *   audio_underruns, samples the audio device had to make up
+ *
+ * Histograms use power-of-two buckets: bucket n counts values below 2^n.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "telemetry.h"
+
+#define TELEMETRY_BUCKETS 48
+
+typedef struct {
+  atomic_uint_fast64_t count, sum;
+  atomic_uint_fast64_t bucket[TELEMETRY_BUCKETS];
+} Telemetry_Histogram;
+
+static struct {
+  atomic_uint_fast64_t instructions[TELEMETRY_CPUS];
+  atomic_uint_fast64_t cycles[TELEMETRY_CPUS];
+  atomic_uint_fast64_t frames, dropped, underruns;
+  Telemetry_Histogram framens, presentns, jitterns, inputns;
+} stats;
+
+static char *statspath, *statstmp;
+static uint32_t period;
+static pthread_t exporter;
+static atomic_int running;
+
+uint64_t telemetrynow() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (uint64_t)t.tv_sec * 1000000000ull + t.tv_nsec;
+}
+
+static void histogramadd(Telemetry_Histogram *h, uint64_t v) {
+  uint32_t b = v ? 64 - __builtin_clzll(v) : 0;
+  if (b >= TELEMETRY_BUCKETS) b = TELEMETRY_BUCKETS - 1;
+
+  atomic_fetch_add_explicit(&h->bucket[b], 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&h->sum, v, memory_order_relaxed);
+  atomic_fetch_add_explicit(&h->count, 1, memory_order_relaxed);
+}
+
+//upper bound of the bucket holding the q-th fraction of the samples
+static uint64_t histogramquantile(uint64_t *bucket, uint64_t count, double q) {
+  uint64_t seen = 0, want = (uint64_t)(q * count);
+  for (uint32_t b = 0; b < TELEMETRY_BUCKETS; b++) {
+    seen += bucket[b];
+    if (seen > want) return 1ull << b;
+  }
+  return 1ull << (TELEMETRY_BUCKETS - 1);
+}
+
+static void histogramprint(FILE *f, const char *name, Telemetry_Histogram *h) {
+  uint64_t bucket[TELEMETRY_BUCKETS], count = 0;
+
+  for (uint32_t b = 0; b < TELEMETRY_BUCKETS; b++) {
+    bucket[b] = atomic_load_explicit(&h->bucket[b], memory_order_relaxed);
+    count += bucket[b];
+  }
+
+  fprintf(f, "%s_count %llu\n", name, (unsigned long long)count);
+  fprintf(f, "%s_sum %llu\n", name, (unsigned long long)atomic_load_explicit(&h->sum, memory_order_relaxed));
+  if (!count) return;
+  fprintf(f, "%s_p50 %llu\n", name, (unsigned long long)histogramquantile(bucket, count, 0.50));
+  fprintf(f, "%s_p99 %llu\n", name, (unsigned long long)histogramquantile(bucket, count, 0.99));
+  for (uint32_t b = 0; b < TELEMETRY_BUCKETS; b++) {
+    if (bucket[b]) fprintf(f, "%s_lt_%llu %llu\n", name, 1ull << b, (unsigned long long)bucket[b]);
+  }
+}
+
+static void *exportloop(void *arg) {
+  uint64_t lastcycles[TELEMETRY_CPUS] = {0};
+  uint64_t last = telemetrynow();
+  struct timespec wait = { period / 1000, (period % 1000) * 1000000l };
+
+  while (atomic_load(&running)) {
+    nanosleep(&wait, NULL);
+
+    uint64_t now = telemetrynow();
+    FILE *f = fopen(statstmp, "w");
+    if (!f) continue;
+
+    for (uint32_t i = 0; i < TELEMETRY_CPUS; i++) {
+      uint64_t cycles = atomic_load_explicit(&stats.cycles[i], memory_order_relaxed);
+      if (!cycles) continue;
+      fprintf(f, "cpu%u_instructions %llu\n", i + 1, (unsigned long long)atomic_load_explicit(&stats.instructions[i], memory_order_relaxed));
+      fprintf(f, "cpu%u_cycles %llu\n", i + 1, (unsigned long long)cycles);
+      fprintf(f, "cpu%u_mhz %.3f\n", i + 1, (double)(cycles - lastcycles[i]) * 1000.0 / (double)(now - last));
+      lastcycles[i] = cycles;
+    }
+    fprintf(f, "frames %llu\n", (unsigned long long)atomic_load_explicit(&stats.frames, memory_order_relaxed));
+    fprintf(f, "dropped_frames %llu\n", (unsigned long long)atomic_load_explicit(&stats.dropped, memory_order_relaxed));
+    fprintf(f, "audio_underruns %llu\n", (unsigned long long)atomic_load_explicit(&stats.underruns, memory_order_relaxed));
+    histogramprint(f, "frame_ns", &stats.framens);
+    histogramprint(f, "present_ns", &stats.presentns);
+    histogramprint(f, "jitter_ns", &stats.jitterns);
+    histogramprint(f, "input_ns", &stats.inputns);
+    fclose(f);
+
+    rename(statstmp, statspath);
+    last = now;
+  }
+  return NULL;
+}
+
+//a forked clone has no exporter thread, it may start its own
+static void forked() {
+  atomic_store(&running, 0);
+}
+
+//starts rewriting path with the current counters every periodms
+int telemetrystart(const char *path, uint32_t periodms) {
+  static uint8_t registered;
+  if (!registered++) pthread_atfork(NULL, NULL, forked);
+
+  statspath = strdup(path);
+  statstmp = malloc(strlen(path) + 5);
+  sprintf(statstmp, "%s.tmp", path);
+  period = periodms;
+
+  atomic_store(&running, 1);
+  if (pthread_create(&exporter, NULL, exportloop, NULL)) {
+    atomic_store(&running, 0);
+    return -1;
+  }
+  return 0;
+}
+
+void telemetrystop() {
+  if (!atomic_exchange(&running, 0)) return;
+  pthread_join(exporter, NULL);
+}
+
+//publishes the running totals of cpu id (1-based)
+void telemetrycpu(uint64_t id, uint32_t instructions, uint64_t cycles) {
+  if (id < 1 || id > TELEMETRY_CPUS) return;
+
+  //instructions is a 32-bit counter in CPU_State, widen it across wraps
+  uint64_t old = atomic_load_explicit(&stats.instructions[id - 1], memory_order_relaxed);
+  uint64_t widened = (old & ~0xFFFFFFFFull) | instructions;
+  if (widened < old) widened += 0x100000000ull;
+
+  atomic_store_explicit(&stats.instructions[id - 1], widened, memory_order_relaxed);
+  atomic_store_explicit(&stats.cycles[id - 1], cycles, memory_order_relaxed);
+}
+
+//a frame was completed, hostns after the previous one
+void telemetryframe(uint64_t hostns) {
+  atomic_fetch_add_explicit(&stats.frames, 1, memory_order_relaxed);
+  histogramadd(&stats.framens, hostns);
+}
+
+//time spent getting a finished frame onto the screen
+void telemetrypresent(uint64_t ns) {
+  histogramadd(&stats.presentns, ns);
+}
+
+void telemetrydropped() {
+  atomic_fetch_add_explicit(&stats.dropped, 1, memory_order_relaxed);
+}
+
+//distance between when a paced frame was due and when it actually ran
+void telemetryjitter(int64_t ns) {
+  histogramadd(&stats.jitterns, ns > 0 ? (uint64_t)ns : 0);
+}
+
+void telemetryinput(uint64_t ns) {
+  histogramadd(&stats.inputns, ns);
+}
+
+//called from the audio thread when the sample ring ran dry
+void telemetryunderrun(uint32_t samples) {
+  atomic_fetch_add_explicit(&stats.underruns, samples, memory_order_relaxed);
+}
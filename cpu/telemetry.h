@@ -0,0 +1,14 @@
+//runtime telemetry counters, see telemetry.c
+
+#define TELEMETRY_CPUS 4
+
+int telemetrystart(const char *path, uint32_t periodms);
+void telemetrystop();
+uint64_t telemetrynow();
+void telemetrycpu(uint64_t id, uint32_t instructions, uint64_t cycles);
+void telemetryframe(uint64_t hostns);
+void telemetrypresent(uint64_t ns);
+void telemetrydropped();
+void telemetryjitter(int64_t ns);
+void telemetryinput(uint64_t ns);
+void telemetryunderrun(uint32_t samples);
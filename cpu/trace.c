@@ -0,0 +1,403 @@
+/* Binary execution traces.
+ *
+ * When tracing is on, the core calls tracerecord() after every instruction
+ * and tracewrite() for every bus write. Records go into a per-thread chunk
+ * buffer; full chunks are handed to a background thread that streams them
+ * to disk, so the emulation thread never blocks on stdio.
+ *
+ * File layout: "HOBOTRC" followed by a version byte, then chunks of
+ * [u32 length][u32 thread][length bytes of records]. Each record is
+ *
+ *   flags            bit0-3 a/x/y/status changed, bit4 ea changed,
+ *                    bit5 has bus writes, bit6 opcode follows,
+ *                    bit7 more flags follow
+ *   [more]           bit0 sp changed, bit1 cpu id follows
+ *   [id]             varint
+ *   [sp]
+ *   pc               zigzag varint delta from the previous pc
+ *   [opcode]         left out when it is the one last recorded at this pc
+ *   [a][x][y][status]   only the ones flagged
+ *   [ea]             zigzag varint delta from the previous ea
+ *   [count {addr, value}...] when bit5 is set, addr a zigzag varint delta
+ *                    from this record's ea, which most writes go to
+ *
+ * "Previous" is the last record of the same cpu: the last two cpus seen on
+ * a thread are tracked, so two cpus interleaved on one thread don't pay
+ * for a full record at every switch. All of it restarts at every chunk,
+ * so chunks decode independently.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "cpu.h"
+#include "trace.h"
+
+#define TRACE_VERSION 2
+#define TRACE_CHUNK 0x10000
+#define TRACE_MAXRECORD 64
+
+#define TRACE_A      0x01
+#define TRACE_X      0x02
+#define TRACE_Y      0x04
+#define TRACE_STATUS 0x08
+#define TRACE_EA     0x10
+#define TRACE_WRITES 0x20
+#define TRACE_OPCODE 0x40
+#define TRACE_MORE   0x80
+
+//the more byte
+#define TRACE_SP     0x01
+#define TRACE_ID     0x02
+
+static const char magic[7] = "HOBOTRC";
+
+typedef struct Trace_Buffer {
+  struct Trace_Buffer *next;
+  uint32_t len, thread;
+  uint8_t data[TRACE_CHUNK];
+} Trace_Buffer;
+
+uint8_t tracing = 0;
+
+static FILE *tracefile;
+static pthread_t writer;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ready = PTHREAD_COND_INITIALIZER;
+static Trace_Buffer *queuehead, *queuetail, *freelist;
+static uint32_t threads;
+static uint8_t stopping;
+
+//per-thread encoder state
+static _Thread_local Trace_Buffer *buf;
+static _Thread_local uint32_t thread;
+static _Thread_local Trace_Record prev, other, pending;
+static _Thread_local uint32_t *seen, generation;
+
+static void *writerloop(void *arg) {
+  pthread_mutex_lock(&lock);
+  while (1) {
+    while (!queuehead && !stopping) pthread_cond_wait(&ready, &lock);
+    if (!queuehead) break;
+
+    Trace_Buffer *b = queuehead;
+    queuehead = b->next;
+    if (!queuehead) queuetail = NULL;
+    pthread_mutex_unlock(&lock);
+
+    uint32_t header[2] = { b->len, b->thread };
+    fwrite(header, sizeof(header), 1, tracefile);
+    fwrite(b->data, 1, b->len, tracefile);
+
+    pthread_mutex_lock(&lock);
+    b->next = freelist;
+    freelist = b;
+  }
+  pthread_mutex_unlock(&lock);
+  return NULL;
+}
+
+static void submit() {
+  pthread_mutex_lock(&lock);
+  buf->next = NULL;
+  if (queuetail) queuetail->next = buf;
+  else queuehead = buf;
+  queuetail = buf;
+
+  if (freelist) {
+    buf = freelist;
+    freelist = buf->next;
+  } else buf = malloc(sizeof(Trace_Buffer));
+  pthread_cond_signal(&ready);
+  pthread_mutex_unlock(&lock);
+
+  buf->len = 0;
+  buf->thread = thread;
+}
+
+static void newbuffer() {
+  pthread_mutex_lock(&lock);
+  thread = threads++;
+  pthread_mutex_unlock(&lock);
+
+  buf = malloc(sizeof(Trace_Buffer));
+  buf->len = 0;
+  buf->thread = thread;
+}
+
+//a forked clone has no writer thread and must not write into our file
+static void forked() {
+  tracing = 0;
+  tracefile = NULL;
+  buf = NULL;
+}
+
+int tracestart(const char *path) {
+  static uint8_t registered;
+  uint8_t version = TRACE_VERSION;
+
+  if (!registered++) pthread_atfork(NULL, NULL, forked);
+
+  tracefile = fopen(path, "wb");
+  if (!tracefile) return -1;
+  fwrite(magic, sizeof(magic), 1, tracefile);
+  fwrite(&version, 1, 1, tracefile);
+
+  stopping = 0;
+  if (pthread_create(&writer, NULL, writerloop, NULL)) {
+    fclose(tracefile);
+    return -1;
+  }
+  tracing = 1;
+  return 0;
+}
+
+//hand the calling thread's partial chunk to the writer
+void traceflush() {
+  if (buf && buf->len) submit();
+}
+
+void tracestop() {
+  if (!tracing) return;
+  tracing = 0;
+  traceflush();
+
+  pthread_mutex_lock(&lock);
+  stopping = 1;
+  pthread_cond_signal(&ready);
+  pthread_mutex_unlock(&lock);
+  pthread_join(writer, NULL);
+  fclose(tracefile);
+}
+
+void tracewrite(uint16_t address, uint8_t value) {
+  if (pending.writes == TRACE_MAXWRITES) return;
+  pending.waddr[pending.writes] = address;
+  pending.wvalue[pending.writes] = value;
+  pending.writes++;
+}
+
+static uint8_t *putvarint(uint8_t *p, uint64_t v) {
+  while (v >= 0x80) {
+    *p++ = (uint8_t)(v | 0x80);
+    v >>= 7;
+  }
+  *p++ = (uint8_t)v;
+  return p;
+}
+
+static inline uint32_t zigzag(int32_t v) {
+  return (uint32_t)((v << 1) ^ (v >> 31));
+}
+
+//stores a register unconditionally and keeps it only when it changed,
+//cheaper than a branch per register
+static inline uint8_t *putchanged(uint8_t *p, uint8_t *flags, uint8_t flag, uint8_t v, uint8_t old) {
+  *p = v;
+  *flags |= (v != old) ? flag : 0;
+  return p + (v != old);
+}
+
+//seen[pc] holds generation << 8 | the opcode last recorded at pc; a chunk
+//starts a new generation, which forgets them all without clearing the table
+static uint32_t *newgeneration(uint32_t *table, uint32_t *gen) {
+  if (!table) table = calloc(0x10000, sizeof(uint32_t));
+  if (++*gen == 1 << 24) {
+    memset(table, 0, 0x10000 * sizeof(uint32_t));
+    *gen = 1;
+  }
+  return table;
+}
+
+//makes last the record to take deltas from for cpu id, keeping the one it
+//replaces in before
+static void switchcpu(Trace_Record *last, Trace_Record *before, uint64_t id) {
+  Trace_Record t = *before;
+
+  *before = *last;
+  if (t.id == id) *last = t;
+  else {
+    memset(last, 0, sizeof(*last));
+    last->id = id;
+  }
+}
+
+void tracerecord(CPU_State *c, uint16_t pc) {
+  uint8_t *p, flags = 0, more = 0;
+  uint32_t key;
+
+  if (!buf) newbuffer();
+  if (!buf->len) {
+    memset(&prev, 0, sizeof(prev));
+    memset(&other, 0, sizeof(other));
+    seen = newgeneration(seen, &generation);
+  }
+
+  p = buf->data + buf->len + 1;
+  if (c->id != prev.id) {
+    switchcpu(&prev, &other, c->id);
+    more |= TRACE_ID;
+  }
+  if (c->sp != prev.sp) more |= TRACE_SP;
+  if (more) {
+    flags |= TRACE_MORE;
+    *p++ = more;
+    if (more & TRACE_ID) p = putvarint(p, c->id);
+    if (more & TRACE_SP) *p++ = c->sp;
+  }
+  p = putvarint(p, zigzag((int16_t)(pc - prev.pc)));
+  key = generation << 8 | c->opcode;
+  if (seen[pc] != key) {
+    seen[pc] = key;
+    flags |= TRACE_OPCODE;
+    *p++ = c->opcode;
+  }
+
+  p = putchanged(p, &flags, TRACE_A, c->a, prev.a);
+  p = putchanged(p, &flags, TRACE_X, c->x, prev.x);
+  p = putchanged(p, &flags, TRACE_Y, c->y, prev.y);
+  p = putchanged(p, &flags, TRACE_STATUS, c->status, prev.status);
+  if (c->ea != prev.ea) {
+    flags |= TRACE_EA;
+    p = putvarint(p, zigzag((int16_t)(c->ea - prev.ea)));
+  }
+  if (pending.writes) {
+    flags |= TRACE_WRITES;
+    *p++ = pending.writes;
+    for (uint8_t i = 0; i < pending.writes; i++) {
+      p = putvarint(p, zigzag((int16_t)(pending.waddr[i] - c->ea)));
+      *p++ = pending.wvalue[i];
+    }
+    pending.writes = 0;
+  }
+  buf->data[buf->len] = flags;
+
+  prev.pc = pc;
+  prev.a = c->a;
+  prev.x = c->x;
+  prev.y = c->y;
+  prev.sp = c->sp;
+  prev.status = c->status;
+  prev.ea = c->ea;
+
+  buf->len = p - buf->data;
+  if (buf->len > TRACE_CHUNK - TRACE_MAXRECORD) submit();
+}
+
+
+struct Trace_Reader {
+  FILE *f;
+  uint8_t *chunk;
+  uint32_t len, pos;
+  Trace_Record prev, other;
+  uint32_t *seen, generation;
+};
+
+Trace_Reader *traceopen(const char *path) {
+  char header[sizeof(magic) + 1];
+  Trace_Reader *r;
+  FILE *f = fopen(path, "rb");
+
+  if (!f) return NULL;
+  if (fread(header, sizeof(header), 1, f) != 1 || memcmp(header, magic, sizeof(magic)) || header[sizeof(magic)] != TRACE_VERSION) {
+    fclose(f);
+    return NULL;
+  }
+
+  r = calloc(1, sizeof(Trace_Reader));
+  r->f = f;
+  r->chunk = malloc(TRACE_CHUNK);
+  return r;
+}
+
+void traceclose(Trace_Reader *r) {
+  fclose(r->f);
+  free(r->chunk);
+  free(r->seen);
+  free(r);
+}
+
+//bounds-checked reads from the current chunk, 0 when it runs out
+static int getbyte(Trace_Reader *r, uint8_t *b) {
+  if (r->pos >= r->len) return 0;
+  *b = r->chunk[r->pos++];
+  return 1;
+}
+
+static int getvarint(Trace_Reader *r, uint64_t *v) {
+  uint8_t b;
+
+  *v = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    if (!getbyte(r, &b)) return 0;
+    *v |= (uint64_t)(b & 0x7F) << shift;
+    if (!(b & 0x80)) return 1;
+  }
+  return 0;
+}
+
+static uint16_t unzigzag(uint64_t v) {
+  return (uint16_t)((v >> 1) ^ -(v & 1));
+}
+
+//decodes the next record into rec, returns 1, 0 at the end of the trace,
+//or -1 if the trace is truncated or corrupt
+int tracenext(Trace_Reader *r, Trace_Record *rec) {
+  uint8_t flags, more = 0;
+  uint64_t zz;
+
+  while (r->pos >= r->len) {
+    uint32_t header[2];
+    size_t got = fread(header, 1, sizeof(header), r->f);
+    if (!got) return 0;
+    if (got != sizeof(header) || header[0] > TRACE_CHUNK) return -1;
+    if (fread(r->chunk, 1, header[0], r->f) != header[0]) return -1;
+    r->len = header[0];
+    r->pos = 0;
+    memset(&r->prev, 0, sizeof(r->prev));
+    memset(&r->other, 0, sizeof(r->other));
+    r->seen = newgeneration(r->seen, &r->generation);
+  }
+
+  if (!getbyte(r, &flags)) return -1;
+  if ((flags & TRACE_MORE) && (!getbyte(r, &more) || !more || (more & ~(TRACE_SP | TRACE_ID)))) return -1;
+  if (more & TRACE_ID) {
+    if (!getvarint(r, &zz) || zz == r->prev.id) return -1;
+    switchcpu(&r->prev, &r->other, zz);
+  }
+
+  *rec = r->prev;
+  rec->writes = 0;
+
+  if ((more & TRACE_SP) && !getbyte(r, &rec->sp)) return -1;
+  if (!getvarint(r, &zz)) return -1;
+  rec->pc = r->prev.pc + unzigzag(zz);
+  if (flags & TRACE_OPCODE) {
+    if (!getbyte(r, &rec->opcode)) return -1;
+    r->seen[rec->pc] = r->generation << 8 | rec->opcode;
+  } else {
+    if (r->seen[rec->pc] >> 8 != r->generation) return -1;
+    rec->opcode = r->seen[rec->pc] & 0xFF;
+  }
+
+  if ((flags & TRACE_A) && !getbyte(r, &rec->a)) return -1;
+  if ((flags & TRACE_X) && !getbyte(r, &rec->x)) return -1;
+  if ((flags & TRACE_Y) && !getbyte(r, &rec->y)) return -1;
+  if ((flags & TRACE_STATUS) && !getbyte(r, &rec->status)) return -1;
+  if (flags & TRACE_EA) {
+    if (!getvarint(r, &zz)) return -1;
+    rec->ea = r->prev.ea + unzigzag(zz);
+  }
+  if (flags & TRACE_WRITES) {
+    if (!getbyte(r, &rec->writes) || rec->writes > TRACE_MAXWRITES) return -1;
+    for (uint8_t i = 0; i < rec->writes; i++) {
+      if (!getvarint(r, &zz) || !getbyte(r, &rec->wvalue[i])) return -1;
+      rec->waddr[i] = rec->ea + unzigzag(zz);
+    }
+  }
+
+  r->prev = *rec;
+  return 1;
+}
@@ -0,0 +1,31 @@
+//binary execution traces, see trace.c, needs cpu.h
+
+#define TRACE_MAXWRITES 8
+
+typedef struct {
+  uint64_t id; //cpu that executed the instruction
+  uint16_t pc; //address of the instruction
+  uint8_t opcode;
+  //registers after the instruction
+  uint8_t a, x, y, sp, status;
+  uint16_t ea;
+
+  //bus writes made by the instruction
+  uint8_t writes;
+  uint16_t waddr[TRACE_MAXWRITES];
+  uint8_t wvalue[TRACE_MAXWRITES];
+} Trace_Record;
+
+typedef struct Trace_Reader Trace_Reader;
+
+extern uint8_t tracing;
+
+int tracestart(const char *path);
+void traceflush();
+void tracestop();
+void tracerecord(CPU_State *c, uint16_t pc);
+void tracewrite(uint16_t address, uint8_t value);
+
+Trace_Reader *traceopen(const char *path);
+int tracenext(Trace_Reader *r, Trace_Record *rec);
+void traceclose(Trace_Reader *r);
@@ -0,0 +1,109 @@
+/* Replays binary traces written by trace.c.
+ *
+ *   tracediff <trace>              print every record
+ *   tracediff [-c id] <a> <b>      report the first record where a and b differ
+ *
+ * With -c only records of that cpu are considered, which is what you want
+ * when the traced run had its cpus on several host threads. Exits 0 when
+ * the traces match, 1 at a divergence and 2 when a trace is unreadable or
+ * corrupt.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cpu.h"
+#include "trace.h"
+
+static void printrecord(uint64_t n, Trace_Record *rec) {
+  printf("%10llu cpu%llu %04X %02X  A:%02X X:%02X Y:%02X SP:%02X P:%02X EA:%04X",
+      (unsigned long long)n, (unsigned long long)rec->id, rec->pc, rec->opcode,
+      rec->a, rec->x, rec->y, rec->sp, rec->status, rec->ea);
+  for (uint8_t i = 0; i < rec->writes; i++) printf(" [%04X]=%02X", rec->waddr[i], rec->wvalue[i]);
+  printf("\n");
+}
+
+static int samerecord(Trace_Record *a, Trace_Record *b) {
+  if (a->id != b->id || a->pc != b->pc || a->opcode != b->opcode) return 0;
+  if (a->a != b->a || a->x != b->x || a->y != b->y || a->sp != b->sp || a->status != b->status) return 0;
+  if (a->ea != b->ea || a->writes != b->writes) return 0;
+  for (uint8_t i = 0; i < a->writes; i++) {
+    if (a->waddr[i] != b->waddr[i] || a->wvalue[i] != b->wvalue[i]) return 0;
+  }
+  return 1;
+}
+
+//1 with the next record, 0 at the end, -1 when the trace is corrupt
+static int nextrecord(Trace_Reader *r, Trace_Record *rec, int filter, uint64_t id) {
+  int got;
+  while ((got = tracenext(r, rec)) > 0) {
+    if (!filter || rec->id == id) return 1;
+  }
+  return got;
+}
+
+int main(int argc, char **argv) {
+  Trace_Reader *a, *b;
+  Trace_Record ra, rb;
+  uint64_t id = 0, n = 0;
+  int filter = 0, i = 1;
+
+  if (argc > 2 && !strcmp(argv[1], "-c")) {
+    filter = 1;
+    id = strtoull(argv[2], NULL, 0);
+    i = 3;
+  }
+  if (argc - i < 1 || argc - i > 2) {
+    printf("usage: %s [-c id] <trace> [other trace]\n", argv[0]);
+    return 2;
+  }
+
+  a = traceopen(argv[i]);
+  if (!a) {
+    printf("could not open trace %s\n", argv[i]);
+    return 2;
+  }
+
+  if (argc - i == 1) {
+    int got;
+    while ((got = nextrecord(a, &ra, filter, id)) > 0) printrecord(n++, &ra);
+    traceclose(a);
+    if (got < 0) {
+      printf("trace %s is corrupt after %llu records\n", argv[i], (unsigned long long)n);
+      return 2;
+    }
+    return 0;
+  }
+
+  b = traceopen(argv[i+1]);
+  if (!b) {
+    printf("could not open trace %s\n", argv[i+1]);
+    return 2;
+  }
+
+  while (1) {
+    int ha = nextrecord(a, &ra, filter, id);
+    int hb = nextrecord(b, &rb, filter, id);
+
+    if (ha < 0 || hb < 0) {
+      printf("trace %s is corrupt after %llu records\n", ha < 0 ? argv[i] : argv[i+1], (unsigned long long)n);
+      return 2;
+    }
+    if (!ha && !hb) {
+      printf("traces match, %llu records\n", (unsigned long long)n);
+      return 0;
+    }
+    if (!ha || !hb) {
+      printf("%s ends after %llu records\n", ha ? argv[i+1] : argv[i], (unsigned long long)n);
+      return 1;
+    }
+    if (!samerecord(&ra, &rb)) {
+      printf("first divergence at record %llu\n", (unsigned long long)n);
+      printrecord(n, &ra);
+      printrecord(n, &rb);
+      return 1;
+    }
+    n++;
+  }
+}
@@ -3,55 +3,73 @@
 module ppu
 (
   input clk,
-  output [7:0] color,
-  output hblank,
-  output vblank
+  //cpu side of the dual-port vram
+  input cpu_we,
+  input [16:0] cpu_addr,
+  input [7:0] cpu_data,
+  output reg [7:0] color,
+  output reg hblank,
+  output reg vblank
 );
 
 reg [16:0] total_count = 17'b0;
 reg [8:0] pixel_count = 9'b0;
 reg [7:0] line_count = 8'b0;
 
-reg [9:0] vram_addrs = 1'b0;
-reg [7:0] vram_byte = 1'b0;
-reg vram_we = 1'b0;
+//two scanline buffers: the current line is shown from the front one while
+//the next line is prefetched into the back one, they swap in hblank
+reg [7:0] line_buffer[1023:0];
+reg front = 1'b0;
 
-reg vblank;
-reg hblank;
+wire [7:0] next_line = (line_count == 239) ? 8'd0 : line_count + 8'd1;
+wire [16:0] fetch_addr = {next_line, 8'b0} + {next_line, 6'b0} + pixel_count;
+wire [7:0] fetch_byte;
+
+//fetch pipeline: where the byte coming out of vram next clock belongs
+reg [8:0] fetch_pixel = 9'b0;
+reg fetch_buffer = 1'b1;
+
+initial
+begin
+  hblank = 1'b0;
+  vblank = 1'b0;
+  color = 8'b0;
+end
 
 vram main_vram
 (
   clk,
-  vram_we,
-  total_count,
-  vram_byte,
-  color
+  cpu_we,
+  cpu_addr,
+  cpu_data,
+  fetch_addr,
+  fetch_byte
 );
 
 always @ (posedge clk)
 begin
-  total_count <= total_count + 1;
-  pixel_count <= pixel_count + 1;
+  total_count <= (total_count == 76799) ? 17'b0 : total_count + 1;
 
-  if (pixel_count == 320)
+  if (pixel_count == 319)
   begin
-    line_count <= line_count + 1;
     pixel_count <= 9'b0;
+    line_count <= next_line;
+    front <= !front;
     hblank <= 1'b1;
+    vblank <= (line_count == 239);
   end
   else
-    hblank <= 1'b0;
-
-  if (line_count == 240)
   begin
-    line_count <= 8'b0;
-    vblank <= 1'b1;
-  end
-  else
+    pixel_count <= pixel_count + 1;
+    hblank <= 1'b0;
     vblank <= 1'b0;
+  end
+
+  line_buffer[{fetch_buffer, fetch_pixel}] <= fetch_byte;
+  fetch_pixel <= pixel_count;
+  fetch_buffer <= !front;
 
-  if (total_count == 76800)
-    total_count <= 1'b0;
+  color <= line_buffer[{front, pixel_count}];
 end
 
 endmodule
@@ -1,9 +1,22 @@
 `include "ppu.v"
 `timescale 1us/1ns
 
+//runs whole frames and checks every pixel and the blanking timing.
+//  +frames=<n>     frames to simulate (default 3)
+//  +vram=<file>    preload vram with $readmemh, otherwise a generated pattern
+//  +golden=<file>  $readmemh file with the expected 320x240 frame; without a
+//                  file the generated pattern is its own reference
+//  +ppm=<file>     write the last frame as a binary ppm
 module ppu_tb;
 
+localparam WIDTH = 320;
+localparam HEIGHT = 240;
+localparam DOTS = WIDTH * HEIGHT;
+
 reg clk = 1'b0;
+reg cpu_we = 1'b0;
+reg [16:0] cpu_addr = 17'b0;
+reg [7:0] cpu_data = 8'b0;
 wire [7:0] color;
 wire vblank;
 wire hblank;
@@ -11,16 +24,126 @@ wire hblank;
 ppu ppu0
 (
   clk,
+  cpu_we,
+  cpu_addr,
+  cpu_data,
   color,
   hblank,
   vblank
 );
 
-always #20
+reg [7:0] frame[DOTS-1:0];
+reg [7:0] golden[DOTS-1:0];
+
+reg [1023:0] vram_file, golden_file, ppm_file;
+integer frames, frame_count, clocks, hblanks, errors, i, f;
+reg [8:0] shown_pixel;
+reg [7:0] shown_line;
+reg shown_valid;
+
+always #20 clk <= !clk;
+
+//color lags the ppu counters by one clock
+always @ (posedge clk)
+begin
+  shown_pixel <= ppu0.pixel_count;
+  shown_line <= ppu0.line_count;
+  shown_valid <= 1'b1;
+end
+
+always @ (negedge clk)
+begin
+  if (shown_valid)
+    frame[shown_line * WIDTH + shown_pixel] = color;
+end
+
+task check_frame;
+  integer mismatches;
+begin
+  mismatches = 0;
+  for (i = 0; i < DOTS; i = i + 1)
+  begin
+    if (frame[i] !== golden[i])
+    begin
+      if (mismatches < 8)
+        $display("FAIL: frame %0d pixel (%0d, %0d) is %h, expected %h", frame_count, i % WIDTH, i / WIDTH, frame[i], golden[i]);
+      mismatches = mismatches + 1;
+    end
+  end
+  errors = errors + mismatches;
+end
+endtask
+
+task write_ppm;
+begin
+  f = $fopen(ppm_file, "wb");
+  $fwrite(f, "P6\n%0d %0d\n255\n", WIDTH, HEIGHT);
+  for (i = 0; i < DOTS; i = i + 1)
+    $fwrite(f, "%c%c%c", frame[i], frame[i], frame[i]);
+  $fclose(f);
+end
+endtask
+
+initial
+begin
+  errors = 0;
+  frame_count = 0;
+  clocks = 0;
+  hblanks = 0;
+  shown_valid = 1'b0;
+
+  if (!$value$plusargs("frames=%d", frames))
+    frames = 3;
+
+  if ($value$plusargs("vram=%s", vram_file))
+    $readmemh(vram_file, ppu0.main_vram.memory);
+  else
+    for (i = 0; i < DOTS; i = i + 1)
+      ppu0.main_vram.memory[i] = (i % WIDTH) ^ ((i / WIDTH) * 3);
+
+  if ($value$plusargs("golden=%s", golden_file))
+    $readmemh(golden_file, golden);
+  else
+    for (i = 0; i < DOTS; i = i + 1)
+      golden[i] = ppu0.main_vram.memory[i];
+end
+
+always @ (posedge clk)
 begin
-  $display("V: %d H: %d -- %d", vblank, hblank, color);
+  clocks <= clocks + 1;
+  if (hblank)
+    hblanks <= hblanks + 1;
+
+  if (vblank)
+  begin
+    //vblank follows the last dot of the frame by one clock
+    if (clocks != (frame_count + 1) * DOTS)
+    begin
+      $display("FAIL: vblank after %0d clocks, expected %0d", clocks, (frame_count + 1) * DOTS);
+      errors = errors + 1;
+    end
+    if (hblanks != (frame_count + 1) * HEIGHT - 1)
+    begin
+      $display("FAIL: %0d hblanks before vblank, expected %0d", hblanks, (frame_count + 1) * HEIGHT - 1);
+      errors = errors + 1;
+    end
+
+    //the first frame shows line 0 before anything was prefetched for it
+    if (frame_count > 0)
+      check_frame;
+    frame_count = frame_count + 1;
 
-  clk <= !clk;
+    if (frame_count == frames)
+    begin
+      if ($value$plusargs("ppm=%s", ppm_file))
+        write_ppm;
+      if (errors == 0)
+        $display("PASS: %0d frames", frame_count);
+      else
+        $display("FAIL: %0d errors in %0d frames", errors, frame_count);
+      $finish;
+    end
+  end
 end
 
 endmodule
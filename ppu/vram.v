@@ -1,23 +1,26 @@
+//true dual-port vram: the cpu writes through one port while the ppu
+//reads through the other, every clock, without contending.
+//a read of the address being written in the same clock returns the old byte.
 module vram
 (
   input clk,
+  //cpu write port
   input we,
-  input [16:0] addr,
-  input [7:0] data,
-  output [7:0] out
+  input [16:0] waddr,
+  input [7:0] wdata,
+  //ppu read port, one clock of latency
+  input [16:0] raddr,
+  output reg [7:0] rdata
 );
 
 reg [7:0] memory[131071:0];
-reg [5:0] addr_reg;
 
 always @ (posedge clk)
 begin
   if (we)
-    memory[addr] <= data;
+    memory[waddr] <= wdata;
 
-  addr_reg <= addr;
+  rdata <= memory[raddr];
 end
 
-assign out = memory[addr_reg];
-
 endmodule
@@ -3,46 +3,93 @@
 
 module vram_tb;
 
-reg [9:0] addrs = 1'b0;
-reg [7:0] byte = 1'b0;
-reg we = 1'b0;
 reg clk = 1'b0;
-wire [7:0] out;
+reg we = 1'b0;
+reg [16:0] waddr = 17'b0;
+reg [7:0] wdata = 8'b0;
+reg [16:0] raddr = 17'b0;
+wire [7:0] rdata;
+
+integer errors = 0;
+integer i;
 
 vram main_vram
 (
   clk,
   we,
-  addrs,
-  byte,
-  out
+  waddr,
+  wdata,
+  raddr,
+  rdata
 );
 
 always #20 clk <= !clk;
 
+task check(input [7:0] expected);
+begin
+  if (rdata !== expected)
+  begin
+    $display("FAIL: read %h at %h, expected %h", rdata, raddr, expected);
+    errors = errors + 1;
+  end
+end
+endtask
+
 initial
 begin
-  byte = 8'b10;
-  addrs = 10'b100;
-  we = 1;
-  #40;
-  addrs = 10'b100;
-  we = 0;
-  #40;
-  $display("%d", out);
-
-  byte = 8'b11;
-  addrs = 10'b101;
-  we = 1;
-  #40;
-  addrs = 10'b101;
-  we = 0;
-  #40;
-  $display("%d", out);
-
-  addrs = 10'b100;
-  #40;
-  $display("%d", out);
+  //fill a block through the write port while the read port walks behind it
+  for (i = 0; i < 256; i = i + 1)
+  begin
+    @ (negedge clk);
+    we = 1'b1;
+    waddr = 17'h10000 + i;
+    wdata = i ^ 8'h5A;
+    raddr = 17'h10000 + i - 1;
+    @ (negedge clk);
+    if (i > 0) check((i - 1) ^ 8'h5A);
+  end
+
+  //every clock: write one address and read back a different one
+  for (i = 0; i < 256; i = i + 1)
+  begin
+    @ (negedge clk);
+    we = 1'b1;
+    waddr = i;
+    wdata = ~i;
+    raddr = 17'h10000 + (255 - i);
+    @ (posedge clk);
+    @ (negedge clk);
+    check((255 - i) ^ 8'h5A);
+  end
+
+  //same address on both ports in one clock reads the old byte
+  @ (negedge clk);
+  we = 1'b1;
+  waddr = 17'h10010;
+  wdata = 8'hEE;
+  raddr = 17'h10010;
+  @ (negedge clk);
+  check(8'h10 ^ 8'h5A);
+  we = 1'b0;
+  @ (negedge clk);
+  check(8'hEE);
+
+  //the top of the address space is reachable from both ports
+  @ (negedge clk);
+  we = 1'b1;
+  waddr = 17'h1FFFF;
+  wdata = 8'hA5;
+  @ (negedge clk);
+  we = 1'b0;
+  raddr = 17'h1FFFF;
+  @ (negedge clk);
+  check(8'hA5);
+
+  if (errors == 0)
+    $display("PASS");
+  else
+    $display("FAIL: %0d errors", errors);
+  $finish;
 end
 
 endmodule